@@ -0,0 +1,36 @@
+-- Smooths over differences between Lua 5.4 and LuaJIT. Loaded before the
+-- other scripts.
+
+table.unpack = table.unpack or unpack
+
+
+-- Scripts are re-run when they change, so set things up only once.
+if jit and not Message.view_t then
+    local ffi = require("ffi")
+
+    -- Must match MessageView in LuaMessage.hpp.
+    ffi.cdef[[
+    struct ircc_string {
+        const char *data;
+        size_t size;
+    };
+    struct ircc_message_view {
+        struct ircc_string prefix;
+        struct ircc_string command;
+        size_t nparams;
+        struct ircc_string params[15];
+    };
+    ]]
+
+    local view_t = ffi.typeof("const struct ircc_message_view *")
+    local methods = getmetatable(Message.new("PING :compat")).__index
+    local view = methods.view
+    Message.view_t = view_t
+
+    -- Message:view() -> FFI view of the message's fields, valid as long as
+    -- the message is. Strings aren't NUL-terminated; use ffi.string(s.data,
+    -- s.size) to get a Lua string.
+    function methods.view(msg)
+        return ffi.cast(view_t, view(msg))
+    end
+end
@@ -1,3 +1,12 @@
+-- PING, PONG, PRIVMSG, NOTICE, JOIN, PART, QUIT, 353 and 366 have built-in
+-- handlers. Defining a handler here for one of them replaces the built-in,
+-- eg. to log private messages somewhere else:
+--
+--   function IRC.privmsg(b, msg)
+--       ...
+--   end
+
+
 -- Extract the username from a source string.
 --  eg. for "foo!bar@baz" returns "foo"
 local function extract_user(str)
@@ -5,82 +14,38 @@ local function extract_user(str)
 end
 
 
-
--- TEMP: using this as an easy-to-trigger thing for tests.
-function IRC.pong(b, msg)
-end
-
-
-function IRC.privmsg(b, msg)
-    local user = extract_user(msg:prefix())
-    local channel_name = msg:params(1)
-    local message = msg:params(2)
-    local channel = b:channels(channel_name)
-    if channel ~= nil then
-        channel:write(user..": "..message)
-    else
-        for _,channel in ipairs(b:channels()) do
-            channel:write(user.." whispers: "..message)
-        end
-    end
-end
-IRC.notice = IRC.privmsg
-
-
-function IRC.ping(b, msg)
-    local m = Message.new("PONG :"..msg:params(1))
-    b:respond(m)
-end
-
-
-function IRC.quit(b, msg)
+function IRC.nick(b, msg)
     local user = extract_user(msg:prefix())
-    local reason = msg:params(1)
-    for _,channel in ipairs(b:channels()) do
-        channel:write("<<< "..user.." quit: "..reason)
-        channel:remove_user(user)
+    local nick = msg:params(1)
+    for _,channel in ipairs(b:user_channels(user)) do
+        channel:write("*** "..user.." is now known as "..nick)
     end
+    b:rename_user(user, nick)
 end
 
 
-function IRC.part(b, msg)
+-- away-notify
+function IRC.away(b, msg)
     local user = extract_user(msg:prefix())
-    local channel_name = msg:params(1)
-    local channel = b:channels(channel_name)
-    if channel ~= nil then
-        channel:write("<<< "..user.." left "..channel_name)
-        channel:remove_user(user)
-    else
-        error("missing channel '"..channel_name.."'")
-    end
-end
-
-
-function IRC.join(b, msg)
-    local user = extract_user(msg:prefix())
-    local channel_name = msg:params(1)
-    local channel = b:channels(channel_name)
-    if channel ~= nil then
-        channel:add_user(user)
-        channel:write(">>> "..user.." joined "..channel_name)
-    else
-        local channel = b:add_channel(channel_name)
-        channel:add_user(user)
-        b:active_channel(channel_name)
+    local reason = msg:params()[1]
+    for _,channel in ipairs(b:user_channels(user)) do
+        if reason ~= nil then
+            channel:write("*** "..user.." is away: "..reason)
+        else
+            channel:write("*** "..user.." is back")
+        end
     end
 end
 
 
-IRC["353"] = function(b, msg)
-    local channel_name = msg:params(3)
-    local names = msg:params(4)
-
-    local channel = b:channels(channel_name)
-    if channel ~= nil then
-        for user in string.gmatch(names, "%g+") do
-            channel:add_user(user)
+-- RPL_ISUPPORT
+IRC["005"] = function(b, msg)
+    local params = msg:params()
+    -- First param is our nick, last is the "are supported by this server" text.
+    for i = 2, #params - 1 do
+        local casemapping = string.match(params[i], "^CASEMAPPING=(.*)")
+        if casemapping ~= nil then
+            b:casemapping(casemapping)
         end
-    else
-        error("missing channel '"..channel_name.."'")
     end
 end
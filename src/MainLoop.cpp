@@ -6,7 +6,9 @@
 
 #include <poll.h>
 
+#include <algorithm>
 #include <system_error>
+#include <vector>
 
 
 /* ==[ Public ]== */
@@ -34,13 +36,32 @@ bool MainLoop::step()
                 0});
     }
 
-    auto const err = poll(monitors.data(), monitors.size(), -1);
+    // Wake up for the next timer, if it's due before the idle timeout.
+    auto timeout = _timeout;
+    if (!_timers.empty())
+    {
+        // Rounded up, so that the timer is due once poll() returns.
+        auto const until = std::chrono::ceil<std::chrono::milliseconds>(
+            _timers.cbegin()->first.first - Clock::now()).count();
+        auto const ms = static_cast<int>(
+            std::clamp<decltype(until)>(until, 0, INT32_MAX));
+        if (timeout < 0 || ms < timeout)
+            timeout = ms;
+    }
+
+    auto const err = poll(monitors.data(), monitors.size(), timeout);
     if (err == -1)
     {
         throw std::system_error{errno, std::generic_category(), "poll()"};
     }
+    else if (err == 0)
+    {
+        if (timeout == _timeout)
+            _timeout = signal_idle.emit()? 0 : -1;
+    }
     else if (err > 0)
     {
+        _timeout = IDLE_DELAY_MS;
         std::vector<int> closed{};
         for (auto const &monitor : monitors)
         {
@@ -63,6 +84,8 @@ bool MainLoop::step()
             }
         }
     }
+    if (_fire_timers())
+        _timeout = IDLE_DELAY_MS;
     return !_fd_monitors.empty();
 }
 
@@ -74,6 +97,26 @@ void MainLoop::run()
 }
 
 
+MainLoop::TimerId MainLoop::add_timer(
+    Clock::time_point when, std::function<void()> fn)
+{
+    auto const id = ++_last_timer;
+    _timers.emplace(std::make_pair(when, id), std::move(fn));
+    _timer_due.emplace(id, when);
+    return id;
+}
+
+
+void MainLoop::cancel_timer(TimerId id)
+{
+    auto const it = _timer_due.find(id);
+    if (it == _timer_due.cend())
+        return;
+    _timers.erase({it->second, id});
+    _timer_due.erase(it);
+}
+
+
 void MainLoop::set_get_monitor_fn(int fd, GetMonitor fn)
 {
     _fd_monitors.at(fd).get_monitor_fn = fn;
@@ -111,4 +154,29 @@ FDStateFlags MainLoop::_pollevent_to_fdstate(short event)
     if (event & POLLOUT)
         state |= FDState::WRITE;
     return state;
-}
\ No newline at end of file
+}
+
+
+bool MainLoop::_fire_timers()
+{
+    // Find the due timers first, so that the callbacks can add and cancel
+    // timers; timers they add wait for the next step.
+    auto const now = Clock::now();
+    std::vector<TimerId> due{};
+    for (auto it = _timers.cbegin();
+            it != _timers.cend() && it->first.first <= now; ++it)
+        due.push_back(it->first.second);
+
+    for (auto const id : due)
+    {
+        auto const when = _timer_due.find(id);
+        if (when == _timer_due.cend())
+            continue;
+        auto const it = _timers.find({when->second, id});
+        auto const fn = std::move(it->second);
+        _timers.erase(it);
+        _timer_due.erase(when);
+        fn();
+    }
+    return !due.empty();
+}
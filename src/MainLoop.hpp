@@ -7,8 +7,12 @@
 
 #include <util/Signal.hpp>
 
+#include <chrono>
+#include <cstdint>
 #include <functional>
+#include <map>
 #include <unordered_map>
+#include <utility>
 
 
 using FDStateFlags = unsigned short;
@@ -34,9 +38,22 @@ enum FDState : FDStateFlags
  * 'signal_on_polled' method. If any of the connected callbacks return TRUE,
  * that file descriptor will be closed. The loop runs until all monitored file
  * descriptors are closed.
+ *
+ * Once nothing has been ready for IDLE_DELAY_MS, the 'idle' signal is emitted
+ * for background work, which should take well under a frame. If it returns
+ * TRUE, there is more to do and it is emitted again once nothing is ready.
+ *
+ * Timers added with 'add_timer' are fired once due, after any ready file
+ * descriptors are handled. All the timers due at once are fired together,
+ * earliest first.
  */
 class MainLoop
 {
+public:
+    using Clock = std::chrono::steady_clock;
+    using TimerId = std::uint64_t;
+
+private:
     using GetMonitor = std::function<FDStateFlags()>;
 
     struct FDMonitor
@@ -46,15 +63,32 @@ class MainLoop
         Signal<void()> signal_on_closed{};
     };
 
+    /** After activity, how long to wait for more before going idle. */
+    static constexpr int IDLE_DELAY_MS = 10;
+
     std::unordered_map<int, FDMonitor> _fd_monitors{};
+    /** poll() timeout: wait for idle time, idle right away, or neither. */
+    int _timeout{IDLE_DELAY_MS};
+
+    /** Timers by when they're due; IDs break ties, in order added. */
+    std::map<std::pair<Clock::time_point, TimerId>, std::function<void()>>
+        _timers{};
+    /** When each timer is due, to find it to cancel. */
+    std::unordered_map<TimerId, Clock::time_point> _timer_due{};
+    TimerId _last_timer{0};
 
     static short _fdstate_to_pollevent(FDStateFlags state);
     static FDStateFlags _pollevent_to_fdstate(short events);
+    /** Fire the timers that are due. Returns true if there were any. */
+    bool _fire_timers();
 
 protected:
     static FDStateFlags _get_monitor_default();
 
 public:
+    /** Emitted when idle. Return TRUE if there is more idle work. */
+    Signal<bool()> signal_idle{};
+
     /** Add a file descriptor to be monitored. */
     void add_fd(int fd);
     /** Stop monitoring the file descriptor. */
@@ -64,6 +98,11 @@ public:
     /** Run the mainloop. */
     void run();
 
+    /** Call FN once, at WHEN or as soon after as possible. */
+    TimerId add_timer(Clock::time_point when, std::function<void()> fn);
+    /** Cancel a timer, unless it has already fired. */
+    void cancel_timer(TimerId id);
+
     /** Set a file descriptor's GetMonitor function. */
     void set_get_monitor_fn(int fd, GetMonitor fn);
     /** Get a file descriptor's "on_polled" Signal. */
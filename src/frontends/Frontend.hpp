@@ -13,6 +13,9 @@
 #include <irc/Message.hpp>
 #include <util/Signal.hpp>
 
+#include <chrono>
+#include <vector>
+
 
 class Frontend
 {
@@ -25,4 +28,25 @@ public:
 
     /** Process available IRC messages from CLIENT. */
     virtual void process_message(Message const &message)=0;
+    /** Process a burst of IRC messages recieved together, in order. */
+    virtual void process_messages(std::vector<Message> const &messages)=0;
+
+    /** File descriptors to watch for reading, for 'watch_fd_ready'. */
+    virtual std::vector<int> get_watch_fds() const=0;
+    /** Process a watched file descriptor. Returns true on error/EOF. */
+    virtual bool watch_fd_ready(int fd)=0;
+
+    /** Do background work when idle. Returns true if there is more. */
+    virtual bool idle()=0;
+
+    /**
+     * Emitted with when 'timers' should next be called, whenever that
+     * changes; time_point::max() for never.
+     */
+    Signal<void(std::chrono::steady_clock::time_point)> signal_timers_due{};
+    /** Run the timers that are due. */
+    virtual void timers()=0;
+
+    /** The IRC connection closed; drop anything waiting for replies. */
+    virtual void disconnected()=0;
 };
@@ -4,23 +4,79 @@
 
 #include "Backend.hpp"
 
+#include <util/debug.hpp>
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
+
+
+/** Turn a channel name into something safe to use as a file name. */
+static std::string scrollback_filename(std::string const &name)
+{
+    std::string out{};
+    for (unsigned char ch : name)
+    {
+        if (std::isalnum(ch) || ch == '#' || ch == '-' || ch == '_')
+            out.push_back(std::tolower(ch));
+        else
+        {
+            char hex[4];
+            std::snprintf(hex, sizeof(hex), "%%%02X", ch);
+            out.append(hex);
+        }
+    }
+    return out;
+}
+
+
 
 Backend::Backend()
 {
-    _channels.emplace("", "<base>");
-    _active_channel = &_channels.at("");
+    if (auto const dir = std::getenv("IRCC_SCROLLBACK_DIR"))
+        _scrollback_dir = dir;
+
+    _channels.emplace_back(new Channel{BASE_CHANNEL, "<base>"});
+    _channel_ids.emplace("", BASE_CHANNEL);
+    _init_channel(*_channels.back());
 }
 
 
-void Backend::set_active_channel(std::string const &channel)
+Channel &Backend::add_channel(std::string const &name)
+{
+    auto const kv = _channel_ids.emplace(
+        casefold(name, _casemapping), _channels.size());
+    if (!kv.second)
+        return *_channels[kv.first->second];
+
+    _channels.emplace_back(new Channel{kv.first->second, name});
+    _init_channel(*_channels.back());
+    return *_channels.back();
+}
+
+
+Channel *Backend::find_channel(std::string const &name)
 {
-    _active_channel = &_channels.at(channel);
+    auto const it = _channel_ids.find(casefold(name, _casemapping));
+    if (it == _channel_ids.cend())
+        return nullptr;
+    return _channels[it->second].get();
 }
 
 
-Channel &Backend::get_active_channel()
+void Backend::set_active_channel(ChannelId id)
 {
-    return *_active_channel;
+    if (id >= _channels.size())
+        throw std::out_of_range{"no such channel"};
+    _active_channel = id;
+}
+
+
+void Backend::set_active_channel(std::string const &channel)
+{
+    set_active_channel(_channel_ids.at(casefold(channel, _casemapping)));
 }
 
 
@@ -28,3 +84,114 @@ void Backend::send_response(Message const &msg)
 {
     signal_response_ready.emit(msg);
 }
+
+
+std::vector<Channel *> Backend::get_user_channels(
+    std::string const &nick) const
+{
+    auto const it = _user_channels.find(casefold(nick, _casemapping));
+    if (it == _user_channels.cend())
+        return {};
+    std::vector<Channel *> channels{};
+    channels.reserve(it->second.size());
+    for (auto const id : it->second)
+        channels.push_back(_channels[id].get());
+    return channels;
+}
+
+
+void Backend::rename_user(std::string const &from, std::string const &to)
+{
+    // Renaming updates _user_channels through the channels' signals.
+    for (auto const channel : get_user_channels(from))
+        channel->rename_user(from, to);
+}
+
+
+void Backend::set_casemapping(CaseMapping mapping)
+{
+    _casemapping = mapping;
+    _channel_ids.clear();
+    _user_channels.clear();
+    for (auto &ptr : _channels)
+    {
+        auto &channel = *ptr;
+        // Keep the base channel under the empty name.
+        auto const kv = _channel_ids.emplace(
+            channel.id == BASE_CHANNEL? "" : casefold(channel.name, mapping),
+            channel.id);
+        // The older channel keeps the name; this one is only found by ID.
+        if (!kv.second)
+        {
+            auto const &other = *_channels[kv.first->second];
+            debugstream << "!!Channel '" << channel.name << "' is the same as '"
+                << other.name << "' under the new casemapping; it can only "
+                "be reached by ID now" << std::endl;
+            channel.push_message(
+                "=== this channel is now the same as " + other.name
+                + "; messages for it go there ===");
+        }
+        channel.set_casemapping(mapping);
+        channel.sort_users();
+        auto const &users = channel.get_users();
+        for (size_t i = 0; i < users.size(); ++i)
+            _on_user_added(channel, users[i].nick);
+    }
+}
+
+
+
+/* ==[ Private ]== */
+void Backend::_init_channel(Channel &channel)
+{
+    // Before the log is indexed, so it's indexed within the share.
+    _share_search_budget();
+    channel.set_casemapping(_casemapping);
+    channel.signal_user_added.connect(
+        [this](Channel &c, std::string const &nick){_on_user_added(c, nick);});
+    channel.signal_user_removed.connect(
+        [this](Channel &c, std::string const &nick){
+            _on_user_removed(c, nick);});
+    _persist(channel);
+}
+
+
+void Backend::_share_search_budget()
+{
+    auto const share = std::min(
+        SearchIndex::DEFAULT_BUDGET, SEARCH_BUDGET / _channels.size());
+    for (auto &channel : _channels)
+        channel->set_search_budget(share);
+}
+
+
+void Backend::_persist(Channel &channel)
+{
+    if (_scrollback_dir.empty())
+        return;
+    try {
+        channel.persist_scrollback(
+            _scrollback_dir + "/" + scrollback_filename(channel.name));
+    }
+    catch (std::exception const &e) {
+        debugstream << "!!Can't open scrollback log for '" << channel.name
+            << "', keeping it in memory: " << e.what() << std::endl;
+    }
+}
+
+
+void Backend::_on_user_added(Channel &channel, std::string const &nick)
+{
+    _user_channels[casefold(nick, _casemapping)].insert(channel.id);
+}
+
+
+void Backend::_on_user_removed(Channel &channel, std::string const &nick)
+{
+    auto const it = _user_channels.find(casefold(nick, _casemapping));
+    if (it == _user_channels.end())
+        return;
+    it->second.erase(channel.id);
+    if (it->second.empty())
+        _user_channels.erase(it);
+}
@@ -8,28 +8,96 @@
 #include "Channel.hpp"
 
 #include <util/Signal.hpp>
+#include <util/strings.hpp>
 
+#include <memory>
+#include <set>
+#include <shared_mutex>
 #include <unordered_map>
 #include <string>
+#include <vector>
 
 
 /**
  * IRC client backend.
+ *
+ * Channels are never removed or moved, so references to them stay valid for
+ * the backend's lifetime. Channel IDs index the channel list, which is kept
+ * in the order channels were added. The base channel has the empty name and
+ * ID BASE_CHANNEL.
+ *
+ * If the IRCC_SCROLLBACK_DIR environment variable is set, channel scrollback
+ * is kept in log files in that directory instead of in memory.
+ *
+ * The channels' search indexes share SEARCH_BUDGET, each getting an equal
+ * share of at most SearchIndex::DEFAULT_BUDGET.
  */
 class Backend
 {
-    std::unordered_map<std::string, Channel> _channels{};
-    Channel *_active_channel; // points into _channels
+public:
+    static constexpr ChannelId BASE_CHANNEL = 0;
+    /** Memory all channels' search indexes may use together. */
+    static constexpr size_t SEARCH_BUDGET = 64 * 1024 * 1024;
+
+private:
+    std::vector<std::unique_ptr<Channel>> _channels{};
+    /** Channel IDs, keyed by casefolded name. */
+    std::unordered_map<std::string, ChannelId> _channel_ids{};
+    ChannelId _active_channel{BASE_CHANNEL};
+    std::string _scrollback_dir{};
+    std::shared_mutex _mutex{};
+    CaseMapping _casemapping{CaseMapping::RFC1459};
+    /** IDs of the channels each user is in, keyed by casefolded nick. */
+    std::unordered_map<std::string, std::set<ChannelId>> _user_channels{};
+
+    /** Set up a newly added channel. */
+    void _init_channel(Channel &channel);
+    /** Share SEARCH_BUDGET out between the channels. */
+    void _share_search_budget();
+    /** Move a channel's scrollback to disk, if enabled. */
+    void _persist(Channel &channel);
+    void _on_user_added(Channel &channel, std::string const &nick);
+    void _on_user_removed(Channel &channel, std::string const &nick);
 
 public:
     Signal<void(Message)> signal_response_ready{};
 
     Backend();
 
-    auto &get_channels() {return _channels;}
+    /**
+     * For when other threads read the backend: held shared while they do,
+     * and exclusively by the main thread while it uses the backend.
+     */
+    std::shared_mutex &get_mutex() {return _mutex;}
+
+    /** Channels in the order they were added; index is the channel ID. */
+    auto const &get_channels() const {return _channels;}
+    /** Add a channel, or get it if it already exists. */
+    Channel &add_channel(std::string const &name);
+    /** Get a channel by ID. Throws std::out_of_range if it doesn't exist. */
+    Channel &get_channel(ChannelId id) {return *_channels.at(id);}
+    /** Get a channel by name. Returns nullptr if it doesn't exist. */
+    Channel *find_channel(std::string const &name);
+
+    /** Throws std::out_of_range if the channel doesn't exist. */
+    void set_active_channel(ChannelId id);
+    /** Throws std::out_of_range if the channel doesn't exist. */
     void set_active_channel(std::string const &channel);
-    Channel &get_active_channel();
+    Channel &get_active_channel() {return *_channels[_active_channel];}
     void send_response(Message const &msg);
+
+    /** Channels that NICK is in, in ID order. */
+    std::vector<Channel *> get_user_channels(std::string const &nick) const;
+    /** Change a user's nick in every channel they're in. */
+    void rename_user(std::string const &from, std::string const &to);
+
+    CaseMapping get_casemapping() const {return _casemapping;}
+    /**
+     * Set the casemapping used to compare nicks, for all channels. Channels
+     * whose names now fold together keep their IDs, but only the oldest is
+     * found by name.
+     */
+    void set_casemapping(CaseMapping mapping);
 };
 
 
@@ -3,29 +3,83 @@
  */
 
 #include "Channel.hpp"
+#include "MappedScrollback.hpp"
+#include "MemoryScrollback.hpp"
+
+#include <util/strings.hpp>
+#include <util/utf8.hpp>
 
 #include <algorithm>
+#include <cctype>
+
+
+/** Most log lines to index when opening a persistent scrollback. */
+static constexpr size_t MAX_REINDEX = 200000;
+/** Queries too short for the index scan at most this many recent lines. */
+static constexpr size_t MAX_SHORT_SCAN = 100000;
+
+
+Channel::Channel(
+    ChannelId id, std::string const &name, Scrollback::Limits limits)
+:   scrollback{new MemoryScrollback{limits}}
+,   id{id}
+,   name{name}
+{
+}
+
 
+Channel::~Channel()
+{
+    if (!index_path.empty())
+        index.save(index_path);
+}
 
-Channel::Channel(std::string const &name)
-:   name{name}
+
+void Channel::persist_scrollback(std::string const &path)
 {
+    auto log = std::make_unique<MappedScrollback>(path);
+    log->set_limits(scrollback->get_limits());
+    scrollback = std::move(log);
+    scrollback_offset = 0;
+    scrollback_row = 0;
+
+    index_path = path + ".tri";
+    auto const size = scrollback->size();
+    if (!index.load(index_path) || index.end() > size)
+        index = SearchIndex{index.budget()};
+
+    // Catch up on lines logged after the index was last saved. If that's
+    // too many, the index restarts at the most recent ones, so the lines
+    // skipped count as no longer indexed rather than leaving a hole.
+    if (size > MAX_REINDEX)
+        index.forget_before(size - MAX_REINDEX);
+    for (size_t i = index.end(); i < size; ++i)
+        index.add(i, (*scrollback)[i]);
 }
 
 
 void Channel::push_message(std::string const &msg)
 {
-    if (scrollback_offset != 0)
+    if (!utf8_is_printable(msg))
+    {
+        push_message(utf8_sanitize(msg));
+        return;
+    }
+
+    if (scrollback_offset != 0 || scrollback_row != 0)
         scrollback_offset += 1;
-    scrollback.push_back(msg);
+    scrollback->push(msg);
+    scrollback_offset = std::min(scrollback_offset, scrollback->size());
+    index.add(scrollback->dropped() + scrollback->size() - 1, msg);
 }
 
 
 void Channel::scroll_up(size_t lines)
 {
     scrollback_offset = std::min({
-        scrollback.size(),
+        scrollback->size(),
         scrollback_offset + lines});
+    scrollback_row = 0;
 }
 
 
@@ -33,16 +87,134 @@ void Channel::scroll_down(size_t lines)
 {
     if (lines <= scrollback_offset)
         scrollback_offset -= lines;
+    scrollback_row = 0;
+}
+
+
+void Channel::scroll_to(size_t i)
+{
+    if (i < scrollback->size())
+    {
+        scrollback_offset = scrollback->size() - 1 - i;
+        scrollback_row = 0;
+    }
+}
+
+
+void Channel::set_scrollback_position(size_t offset, size_t row)
+{
+    scrollback_offset = std::min(offset, scrollback->size());
+    scrollback_row = row;
+}
+
+
+size_t Channel::unindexed() const
+{
+    auto const dropped = scrollback->dropped();
+    auto const first = index.first();
+    return std::min(scrollback->size(), first > dropped? first - dropped : 0);
+}
+
+
+void Channel::set_search_budget(size_t budget)
+{
+    index.set_budget(budget);
+}
+
+
+std::vector<size_t> Channel::search(std::string const &query) const
+{
+    std::vector<size_t> found{};
+    if (query.empty())
+        return found;
+
+    auto const needle = lowercase(query);
+    auto const matches = [&needle](std::string_view line){
+        return std::search(
+            line.cbegin(), line.cend(),
+            needle.cbegin(), needle.cend(),
+            [](unsigned char a, unsigned char b){
+                return std::tolower(a) == b;})
+            != line.cend();
+    };
+
+    auto const size = scrollback->size();
+    if (needle.size() < 3)
+    {
+        for (size_t i = size > MAX_SHORT_SCAN? size - MAX_SHORT_SCAN : 0;
+                i < size;
+                ++i)
+        {
+            if (matches((*scrollback)[i]))
+                found.push_back(i);
+        }
+        return found;
+    }
+
+    // Line numbers in the index count dropped lines too.
+    auto const dropped = scrollback->dropped();
+    for (auto const n : index.candidates(needle))
+    {
+        if (n < dropped || n - dropped >= size)
+            continue;
+        if (matches((*scrollback)[n - dropped]))
+            found.push_back(n - dropped);
+    }
+    return found;
+}
+
+
+void Channel::set_scrollback_limits(Scrollback::Limits limits)
+{
+    scrollback->set_limits(limits);
+    scrollback_offset = std::min(scrollback_offset, scrollback->size());
 }
 
 
 void Channel::add_user(std::string const &user)
 {
-    users.insert(user);
+    if (users.insert(user))
+        signal_user_added.emit(*this, user);
+}
+
+
+void Channel::add_users(std::string_view names)
+{
+    for (auto const user : users.insert_names(split_words(names)))
+        signal_user_added.emit(*this, user->nick);
+}
+
+
+void Channel::end_names()
+{
+    users.sort();
+}
+
+
+void Channel::sort_users()
+{
+    users.sort();
 }
 
 
 void Channel::remove_user(std::string const &user)
 {
-    users.erase(user);
+    if (users.erase(user))
+        signal_user_removed.emit(*this, user);
+}
+
+
+void Channel::rename_user(std::string const &from, std::string const &to)
+{
+    if (users.rename(from, to))
+    {
+        signal_user_removed.emit(*this, from);
+        signal_user_added.emit(*this, to);
+    }
+}
+
+
+void Channel::set_casemapping(CaseMapping mapping)
+{
+    users.set_casemapping(mapping);
 }
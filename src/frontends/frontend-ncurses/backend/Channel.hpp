@@ -5,42 +5,116 @@
 #ifndef FRONTENDNCURSES_CHANNEL_HPP
 #define FRONTENDNCURSES_CHANNEL_HPP
 
+#include "Scrollback.hpp"
+#include "SearchIndex.hpp"
+#include "UserIndex.hpp"
+
 #include <irc/Message.hpp>
+#include <util/Signal.hpp>
 
-#include <set>
+#include <cstddef>
+#include <memory>
 #include <string>
 #include <vector>
 
 
+/** Dense channel identifier, assigned by Backend in the order added. */
+using ChannelId = std::size_t;
+
+
 /**
  * An IRC channel with scrollback buffer.
  */
 class Channel
 {
-    std::set<std::string> users{};
-    std::vector<std::string> scrollback{};
+    UserIndex users{};
+    std::unique_ptr<Scrollback> scrollback;
     size_t scrollback_offset{0};
+    size_t scrollback_row{0};
+    SearchIndex index{};
+    /** Where the search index is saved, if the scrollback is persistent. */
+    std::string index_path{};
 
 public:
+    ChannelId const id;
     std::string const name;
 
-    Channel(std::string const &name);
+    /** Emitted with the nick of each user added to the channel. */
+    Signal<void(Channel &, std::string const &)> signal_user_added{};
+    /** Emitted with the nick of each user removed from the channel. */
+    Signal<void(Channel &, std::string const &)> signal_user_removed{};
+
+    Channel(
+        ChannelId id,
+        std::string const &name,
+        Scrollback::Limits limits=Scrollback::DEFAULT_LIMITS);
+    ~Channel();
 
-    /** Add a message to the scrollback. */
+    /**
+     * Keep scrollback in a log file at PATH instead of in memory. Lines
+     * already in the log become the scrollback, and the search index is
+     * kept next to it. Throws if the log cannot be opened.
+     */
+    void persist_scrollback(std::string const &path);
+
+    /**
+     * Add a message to the scrollback. Invalid UTF-8 and control characters
+     * are cleaned up first.
+     */
     void push_message(std::string const &msg);
 
     /** Scrollback buffer up. */
     void scroll_up(size_t lines);
     /** Scrollback buffer down. */
     void scroll_down(size_t lines);
+    /** Scroll so that scrollback line I is at the bottom. */
+    void scroll_to(size_t i);
+    /**
+     * Scroll so that the line OFFSET lines up from the end is at the bottom,
+     * with its last ROW rows hidden below.
+     */
+    void set_scrollback_position(size_t offset, size_t row);
+
+    /**
+     * Find scrollback lines containing QUERY, ignoring case. Returns their
+     * indices in ascending order.
+     */
+    std::vector<size_t> search(std::string const &query) const;
+    /**
+     * Number of the oldest scrollback lines that are no longer indexed, so
+     * 'search' doesn't find them for queries of 3 or more bytes.
+     */
+    size_t unindexed() const;
+    /** Limit the memory the search index may use to BUDGET bytes. */
+    void set_search_budget(size_t budget);
 
     /** Add user to user list. */
     void add_user(std::string const &user);
+    /**
+     * Add users from a space-separated NAMES list. The user list is not
+     * re-sorted until 'end_names' is called.
+     */
+    void add_users(std::string_view names);
+    /** Finish a NAMES list. */
+    void end_names();
+    /**
+     * Bring the user list's display order up to date, after users joined or
+     * left. Cheap if it already is.
+     */
+    void sort_users();
     /** Remove user from user list. */
     void remove_user(std::string const &user);
+    /** Change a user's nick. */
+    void rename_user(std::string const &from, std::string const &to);
+    /** Set the casemapping used to compare nicks. */
+    void set_casemapping(CaseMapping mapping);
+
+    /** Change the scrollback line and byte limits. */
+    void set_scrollback_limits(Scrollback::Limits limits);
 
-    auto &get_scrollback() const {return scrollback;}
+    Scrollback const &get_scrollback() const {return *scrollback;}
     auto get_scrollback_offset() const {return scrollback_offset;}
+    auto get_scrollback_row() const {return scrollback_row;}
     auto &get_users() const {return users;}
 };
 
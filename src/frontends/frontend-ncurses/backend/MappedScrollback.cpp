@@ -0,0 +1,154 @@
+/* Copyright (C) 2023 Trevor Last
+ * See LICENSE file for copyright and license details.
+ */
+
+#include "MappedScrollback.hpp"
+
+#include <util/utf8.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+
+MappedScrollback::MappedScrollback(std::string const &path)
+:   _log{path + ".log"}
+,   _index{path + ".idx"}
+{
+    // Another client appending to the same files would corrupt the index.
+    if (!_log.try_lock() || !_index.try_lock())
+        throw std::runtime_error{path + ".log is in use by another client"};
+
+    if (_index.capacity() < HEADER_SIZE)
+    {
+        _index.resize(HEADER_SIZE);
+        std::memcpy(_index.data(), MAGIC, sizeof(MAGIC));
+        std::memset(_index.data() + sizeof(MAGIC), 0, sizeof(Offset));
+    }
+    else if (std::memcmp(_index.data(), MAGIC_V1, sizeof(MAGIC_V1)) == 0)
+    {
+        _upgrade();
+    }
+    else if (std::memcmp(_index.data(), MAGIC, sizeof(MAGIC)) != 0)
+    {
+        throw std::runtime_error{path + ".idx is not a scrollback index"};
+    }
+
+    Offset count;
+    std::memcpy(&count, _index.data() + sizeof(MAGIC), sizeof(count));
+
+    // If we weren't shut down cleanly, the index can claim more lines than
+    // made it to disk. Only trust entries that are actually there.
+    count = std::min<Offset>(
+        count,
+        (_index.capacity() - HEADER_SIZE) / ENTRY_SIZE);
+    _count = count;
+    while (_count > 0 && _end(_count - 1) > _log.capacity())
+        _count--;
+    _log_size = _count > 0? _end(_count - 1) : 0;
+}
+
+
+MappedScrollback::~MappedScrollback()
+{
+    // Trim the preallocated space so the log stays a plain text file.
+    try {
+        _log.resize(_log_size);
+        _index.resize(HEADER_SIZE + _count * ENTRY_SIZE);
+    }
+    catch (std::exception const &) {
+    }
+}
+
+
+void MappedScrollback::push(std::string_view line)
+{
+    Offset const end = _log_size + line.size() + 1;
+    _log.reserve(end);
+    std::memcpy(_log.data() + _log_size, line.data(), line.size());
+    _log.data()[end - 1] = '\n';
+    _log_size = end;
+
+    // Write the entry before bumping the count, so a crash in between leaves
+    // the index consistent.
+    _index.reserve(HEADER_SIZE + (_count + 1) * ENTRY_SIZE);
+    _set_entry(_count, end, static_cast<Width>(utf8_width(line)));
+    _count += 1;
+    Offset const count = _count;
+    std::memcpy(_index.data() + sizeof(MAGIC), &count, sizeof(count));
+}
+
+
+std::string_view MappedScrollback::operator[](size_t i) const
+{
+    Offset const begin = i > 0? _end(i - 1) : 0;
+    Offset const end = _end(i);
+    return {_log.data() + begin, static_cast<size_t>(end - begin - 1)};
+}
+
+
+size_t MappedScrollback::width(size_t i) const
+{
+    Width width;
+    std::memcpy(
+        &width,
+        _index.data() + HEADER_SIZE + i * ENTRY_SIZE + sizeof(Offset),
+        sizeof(width));
+    return width;
+}
+
+
+
+/* ==[ Private ]== */
+MappedScrollback::Offset MappedScrollback::_end(size_t i) const
+{
+    Offset end;
+    std::memcpy(
+        &end,
+        _index.data() + HEADER_SIZE + i * ENTRY_SIZE,
+        sizeof(end));
+    return end;
+}
+
+
+void MappedScrollback::_set_entry(size_t i, Offset end, Width width)
+{
+    char *const entry = _index.data() + HEADER_SIZE + i * ENTRY_SIZE;
+    std::memcpy(entry, &end, sizeof(end));
+    std::memcpy(entry + sizeof(end), &width, sizeof(width));
+}
+
+
+void MappedScrollback::_upgrade()
+{
+    Offset count;
+    std::memcpy(&count, _index.data() + sizeof(MAGIC), sizeof(count));
+    count = std::min<Offset>(
+        count,
+        (_index.capacity() - HEADER_SIZE) / sizeof(Offset));
+    std::vector<Offset> ends(count);
+    std::memcpy(
+        ends.data(), _index.data() + HEADER_SIZE, count * sizeof(Offset));
+
+    // Mark the index empty first: a crash while rewriting it loses the
+    // history's index, but never leaves wrong entries behind.
+    Offset const none = 0;
+    std::memcpy(_index.data(), MAGIC, sizeof(MAGIC));
+    std::memcpy(_index.data() + sizeof(MAGIC), &none, sizeof(none));
+    _index.resize(HEADER_SIZE + ends.size() * ENTRY_SIZE);
+
+    Offset begin = 0;
+    count = 0;
+    for (auto const end : ends)
+    {
+        // Stop at entries for lines that never made it to the log.
+        if (end <= begin || end > _log.capacity())
+            break;
+        std::string_view const line{
+            _log.data() + begin, static_cast<size_t>(end - begin - 1)};
+        _set_entry(count++, end, static_cast<Width>(utf8_width(line)));
+        begin = end;
+    }
+    std::memcpy(_index.data() + sizeof(MAGIC), &count, sizeof(count));
+}
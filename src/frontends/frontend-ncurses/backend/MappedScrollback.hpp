@@ -0,0 +1,79 @@
+/* Copyright (C) 2023 Trevor Last
+ * See LICENSE file for copyright and license details.
+ */
+
+#ifndef FRONTENDNCURSES_MAPPEDSCROLLBACK_HPP
+#define FRONTENDNCURSES_MAPPEDSCROLLBACK_HPP
+
+#include "Scrollback.hpp"
+
+#include <util/MappedFile.hpp>
+
+#include <cstdint>
+#include <string>
+
+
+/**
+ * Disk-backed scrollback store.
+ *
+ * Lines are appended to a plain-text log file, and the end offset and display
+ * width of each line are recorded in a separate index file, so drawing a line
+ * needs no measuring. Both files are memory-mapped, so
+ * opening an existing log is constant time and history costs no memory until
+ * it is actually read. The whole log stays available; limits are recorded but
+ * not applied.
+ *
+ * The files are locked while open, so only one client at a time can log to
+ * them; the constructor throws if another has them.
+ */
+class MappedScrollback : public Scrollback
+{
+public:
+    /** Open the log at PATH.log and index at PATH.idx, creating if needed. */
+    MappedScrollback(std::string const &path);
+    ~MappedScrollback();
+
+    void push(std::string_view line) override;
+
+    std::string_view operator[](size_t i) const override;
+    size_t width(size_t i) const override;
+    size_t size() const override {return _count;}
+    size_t dropped() const override {return 0;}
+
+    /** Size of the log file. */
+    size_t bytes() const override {return _log_size;}
+    /** Heap memory held by the store. Mapped pages are not counted. */
+    size_t footprint() const override {return sizeof(*this);}
+
+    Limits get_limits() const override {return _limits;}
+    void set_limits(Limits limits) override {_limits = limits;}
+
+private:
+    using Offset = std::uint64_t;
+    using Width = std::uint32_t;
+    static constexpr char MAGIC[8] = {'I','R','C','C','I','D','X','2'};
+    /** Magic of indexes without widths, which are upgraded when opened. */
+    static constexpr char MAGIC_V1[8] = {'I','R','C','C','I','D','X','1'};
+    /**
+     * Index file layout: MAGIC, line count, then each line's end offset and
+     * width.
+     */
+    static constexpr size_t HEADER_SIZE = sizeof(MAGIC) + sizeof(Offset);
+    static constexpr size_t ENTRY_SIZE = sizeof(Offset) + sizeof(Width);
+
+    MappedFile _log;
+    MappedFile _index;
+    size_t _count{0};
+    size_t _log_size{0};
+    Limits _limits{DEFAULT_LIMITS};
+
+    /** Offset one past the end of line I, including its newline. */
+    Offset _end(size_t i) const;
+    /** Record line I's end offset and width. */
+    void _set_entry(size_t i, Offset end, Width width);
+    /** Rewrite a MAGIC_V1 index in the current layout. */
+    void _upgrade();
+};
+
+
+#endif
@@ -0,0 +1,128 @@
+/* Copyright (C) 2023 Trevor Last
+ * See LICENSE file for copyright and license details.
+ */
+
+#include "MemoryScrollback.hpp"
+
+#include <util/utf8.hpp>
+
+#include <cstring>
+
+
+MemoryScrollback::MemoryScrollback(Limits limits)
+:   _limits{limits}
+{
+}
+
+
+void MemoryScrollback::push(std::string_view line)
+{
+    Header const header{
+        static_cast<std::uint32_t>(line.size()),
+        static_cast<std::uint32_t>(utf8_width(line))};
+    auto const record = sizeof(header) + line.size();
+
+    auto &chunk = _reserve(record);
+    char *const ptr = chunk.data.get() + chunk.used;
+    std::memcpy(ptr, &header, sizeof(header));
+    std::memcpy(ptr + sizeof(header), line.data(), line.size());
+    chunk.used += record;
+    chunk.lines += 1;
+
+    _lines.push_back(ptr);
+    _bytes += record;
+    _enforce_limits();
+}
+
+
+std::string_view MemoryScrollback::operator[](size_t i) const
+{
+    return {_lines[i] + sizeof(Header), _header(i).length};
+}
+
+
+size_t MemoryScrollback::width(size_t i) const
+{
+    return _header(i).width;
+}
+
+
+size_t MemoryScrollback::footprint() const
+{
+    size_t total = sizeof(*this) + _lines.size() * sizeof(char const *);
+    for (auto const &chunk : _chunks)
+        total += chunk.capacity;
+    if (_spare)
+        total += CHUNK_SIZE;
+    return total;
+}
+
+
+void MemoryScrollback::set_limits(Limits limits)
+{
+    _limits = limits;
+    _enforce_limits();
+}
+
+
+
+/* ==[ Private ]== */
+MemoryScrollback::Chunk &MemoryScrollback::_reserve(size_t size)
+{
+    if (!_chunks.empty())
+    {
+        auto &back = _chunks.back();
+        if (back.capacity - back.used >= size)
+            return back;
+    }
+
+    if (size > CHUNK_SIZE)
+    {
+        _chunks.push_back(Chunk{std::make_unique<char[]>(size), size, 0, 0});
+    }
+    else
+    {
+        auto data = (
+            _spare? std::move(_spare) : std::make_unique<char[]>(CHUNK_SIZE));
+        _chunks.push_back(Chunk{std::move(data), CHUNK_SIZE, 0, 0});
+    }
+    return _chunks.back();
+}
+
+
+MemoryScrollback::Header MemoryScrollback::_header(size_t i) const
+{
+    Header header;
+    std::memcpy(&header, _lines[i], sizeof(header));
+    return header;
+}
+
+
+void MemoryScrollback::_pop_front()
+{
+    auto const header = _header(0);
+    _lines.pop_front();
+    _bytes -= sizeof(header) + header.length;
+    _dropped += 1;
+
+    // Lines are stored in order, so the oldest line is always in the first
+    // chunk which still has lines.
+    auto &front = _chunks.front();
+    front.lines -= 1;
+    if (front.lines == 0)
+    {
+        if (front.capacity == CHUNK_SIZE)
+            _spare = std::move(front.data);
+        _chunks.pop_front();
+    }
+}
+
+
+void MemoryScrollback::_enforce_limits()
+{
+    while (!_lines.empty()
+        && (_lines.size() > _limits.lines || _bytes > _limits.bytes))
+    {
+        _pop_front();
+    }
+}
@@ -0,0 +1,83 @@
+/* Copyright (C) 2023 Trevor Last
+ * See LICENSE file for copyright and license details.
+ */
+
+#ifndef FRONTENDNCURSES_MEMORYSCROLLBACK_HPP
+#define FRONTENDNCURSES_MEMORYSCROLLBACK_HPP
+
+#include "Scrollback.hpp"
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+
+
+/**
+ * Bounded in-memory scrollback store.
+ *
+ * Lines are stored contiguously in fixed-size chunks, each line prefixed by
+ * its length and display width. Appending a line never moves existing lines,
+ * and any line can be looked up by index in constant time. When either the
+ * line limit or the byte limit is exceeded, the oldest lines are dropped, and
+ * chunks that no longer hold any lines are released.
+ */
+class MemoryScrollback : public Scrollback
+{
+public:
+    /** Size of a regular chunk. Longer lines get a chunk to themselves. */
+    static constexpr size_t CHUNK_SIZE = 64 * 1024;
+
+    MemoryScrollback(Limits limits=DEFAULT_LIMITS);
+
+    /** Append a line, dropping the oldest lines if a limit is exceeded. */
+    void push(std::string_view line) override;
+
+    std::string_view operator[](size_t i) const override;
+    size_t width(size_t i) const override;
+    size_t size() const override {return _lines.size();}
+    size_t dropped() const override {return _dropped;}
+
+    /** Bytes used by stored lines, including their headers. */
+    size_t bytes() const override {return _bytes;}
+    /** Total memory held by the store, including unused chunk space. */
+    size_t footprint() const override;
+
+    Limits get_limits() const override {return _limits;}
+    void set_limits(Limits limits) override;
+
+private:
+    struct Header
+    {
+        std::uint32_t length;
+        std::uint32_t width;
+    };
+
+    struct Chunk
+    {
+        std::unique_ptr<char[]> data;
+        size_t capacity;
+        size_t used;
+        /** Number of stored lines in this chunk. */
+        size_t lines;
+    };
+
+    Limits _limits;
+    std::deque<Chunk> _chunks{};
+    /** Last released regular chunk, kept around for reuse. */
+    std::unique_ptr<char[]> _spare{};
+    /** Points to the header of each line, in order. */
+    std::deque<char const *> _lines{};
+    size_t _bytes{0};
+    size_t _dropped{0};
+
+    /** Get a chunk with at least SIZE bytes free at the back of _chunks. */
+    Chunk &_reserve(size_t size);
+    Header _header(size_t i) const;
+    /** Drop the oldest line. */
+    void _pop_front();
+    /** Drop lines until within limits. */
+    void _enforce_limits();
+};
+
+
+#endif
@@ -0,0 +1,61 @@
+/* Copyright (C) 2023 Trevor Last
+ * See LICENSE file for copyright and license details.
+ */
+
+#ifndef FRONTENDNCURSES_SCROLLBACK_HPP
+#define FRONTENDNCURSES_SCROLLBACK_HPP
+
+#include <cstddef>
+#include <string_view>
+
+
+/**
+ * Scrollback storage interface.
+ *
+ * Index 0 is the oldest line still available. Views returned by operator[]
+ * are only valid until the next call to 'push'. Lines pushed must be
+ * printable UTF-8 (see 'utf8_sanitize').
+ */
+class Scrollback
+{
+public:
+    struct Limits
+    {
+        /** Maximum number of lines kept. */
+        size_t lines;
+        /** Maximum number of bytes kept. */
+        size_t bytes;
+    };
+    static constexpr Limits DEFAULT_LIMITS{10000, 4 * 1024 * 1024};
+
+    virtual ~Scrollback()=default;
+
+    /** Append a line. */
+    virtual void push(std::string_view line)=0;
+
+    /** Get line I. Undefined if I >= size(). */
+    virtual std::string_view operator[](size_t i) const=0;
+    /** Display width of line I, in terminal columns. */
+    virtual size_t width(size_t i) const=0;
+    /** Number of lines available. */
+    virtual size_t size() const=0;
+    bool empty() const {return size() == 0;}
+    /** Number of lines dropped so far. Line I was the (dropped()+I)th line. */
+    virtual size_t dropped() const=0;
+
+    /** Bytes used by stored lines. */
+    virtual size_t bytes() const=0;
+    /** Memory held by the store. */
+    virtual size_t footprint() const=0;
+
+    virtual Limits get_limits() const=0;
+    /**
+     * Change limits. Stores that apply them drop lines immediately if the
+     * new limits are lower; stores that keep the whole history, such as
+     * MappedScrollback, only record them.
+     */
+    virtual void set_limits(Limits limits)=0;
+};
+
+
+#endif
@@ -0,0 +1,265 @@
+/* Copyright (C) 2023 Trevor Last
+ * See LICENSE file for copyright and license details.
+ */
+
+#include "SearchIndex.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <fstream>
+
+
+/** Rough per-trigram overhead of the hash map and Postings. */
+static constexpr size_t ENTRY_OVERHEAD = 64;
+static constexpr char MAGIC[8] = {'I','R','C','C','T','R','I','1'};
+
+
+static void put_varint(std::vector<std::uint8_t> &out, size_t value)
+{
+    while (value >= 0x80)
+    {
+        out.push_back((value & 0x7f) | 0x80);
+        value >>= 7;
+    }
+    out.push_back(value);
+}
+
+
+static size_t get_varint(std::uint8_t const *&ptr)
+{
+    size_t value = 0;
+    for (int shift = 0; ; shift += 7)
+    {
+        auto const byte = *ptr++;
+        value |= static_cast<size_t>(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+            return value;
+    }
+}
+
+
+
+SearchIndex::SearchIndex(size_t budget)
+:   _budget{budget}
+{
+}
+
+
+void SearchIndex::add(size_t n, std::string_view line)
+{
+    for (auto const trigram : _trigrams(line))
+    {
+        auto const kv = _postings.try_emplace(trigram);
+        auto &postings = kv.first->second;
+        if (kv.second)
+            _footprint += ENTRY_OVERHEAD;
+        else if (postings.last == n)
+            continue;
+
+        auto const before = postings.data.size();
+        put_varint(postings.data, n - postings.last);
+        postings.last = n;
+        _footprint += postings.data.size() - before;
+    }
+    _end = n + 1;
+
+    if (_footprint > _budget)
+        _prune();
+}
+
+
+void SearchIndex::forget_before(size_t n)
+{
+    if (n <= _first)
+        return;
+    _first = n;
+    _end = std::max(_end, n);
+    _footprint = 0;
+
+    for (auto it = _postings.begin(); it != _postings.end(); )
+    {
+        auto &postings = it->second;
+        if (postings.last < _first)
+        {
+            it = _postings.erase(it);
+            continue;
+        }
+
+        // Skip postings before the cutoff, then re-encode the first kept
+        // line as an absolute number. The deltas after it are unchanged.
+        std::uint8_t const *ptr = postings.data.data();
+        auto const end = ptr + postings.data.size();
+        size_t line = 0;
+        do {
+            line += get_varint(ptr);
+        } while (line < _first);
+
+        std::vector<std::uint8_t> data{};
+        put_varint(data, line);
+        data.insert(data.end(), ptr, end);
+        data.shrink_to_fit();
+        postings.data = std::move(data);
+
+        _footprint += ENTRY_OVERHEAD + postings.data.size();
+        ++it;
+    }
+}
+
+
+void SearchIndex::set_budget(size_t budget)
+{
+    _budget = budget;
+    while (_footprint > _budget && _first < _end)
+        _prune();
+}
+
+
+std::vector<size_t> SearchIndex::candidates(std::string_view query) const
+{
+    std::vector<Postings const *> lists{};
+    for (auto const trigram : _trigrams(query))
+    {
+        auto const it = _postings.find(trigram);
+        if (it == _postings.cend())
+            return {};
+        lists.push_back(&it->second);
+    }
+    if (lists.empty())
+        return {};
+
+    // Start with the shortest list, so the working set only shrinks.
+    std::sort(
+        lists.begin(), lists.end(),
+        [](auto a, auto b){return a->data.size() < b->data.size();});
+
+    auto result = _decode(*lists.front());
+    for (size_t i = 1; i < lists.size() && !result.empty(); ++i)
+    {
+        auto const other = _decode(*lists[i]);
+        std::vector<size_t> both{};
+        std::set_intersection(
+            result.cbegin(), result.cend(),
+            other.cbegin(), other.cend(),
+            std::back_inserter(both));
+        result = std::move(both);
+    }
+    return result;
+}
+
+
+bool SearchIndex::save(std::string const &path) const
+{
+    std::ofstream out{path, std::ios::binary | std::ios::trunc};
+    auto const put = [&out](auto value){
+        out.write(reinterpret_cast<char const *>(&value), sizeof(value));};
+
+    out.write(MAGIC, sizeof(MAGIC));
+    put(std::uint64_t{_first});
+    put(std::uint64_t{_end});
+    put(std::uint64_t{_postings.size()});
+    for (auto const &kv : _postings)
+    {
+        put(kv.first);
+        put(std::uint64_t{kv.second.last});
+        put(std::uint64_t{kv.second.data.size()});
+        out.write(
+            reinterpret_cast<char const *>(kv.second.data.data()),
+            kv.second.data.size());
+    }
+    return out.good();
+}
+
+
+bool SearchIndex::load(std::string const &path)
+{
+    std::ifstream in{path, std::ios::binary};
+    auto const get = [&in](auto &value){
+        in.read(reinterpret_cast<char *>(&value), sizeof(value));};
+
+    char magic[sizeof(MAGIC)];
+    in.read(magic, sizeof(magic));
+    if (!in || std::memcmp(magic, MAGIC, sizeof(MAGIC)) != 0)
+        return false;
+
+    std::uint64_t first, end, count;
+    get(first);
+    get(end);
+    get(count);
+
+    decltype(_postings) postings{};
+    size_t footprint = 0;
+    for (std::uint64_t i = 0; i < count && in; ++i)
+    {
+        Trigram trigram;
+        std::uint64_t last, size;
+        get(trigram);
+        get(last);
+        get(size);
+        if (!in)
+            break;
+
+        auto &p = postings[trigram];
+        p.last = last;
+        p.data.resize(size);
+        in.read(reinterpret_cast<char *>(p.data.data()), size);
+        footprint += ENTRY_OVERHEAD + size;
+    }
+    if (!in)
+        return false;
+
+    _postings = std::move(postings);
+    _footprint = footprint;
+    _first = first;
+    _end = end;
+    if (_footprint > _budget)
+        _prune();
+    return true;
+}
+
+
+
+/* ==[ Private ]== */
+std::vector<SearchIndex::Trigram> SearchIndex::_trigrams(std::string_view str)
+{
+    std::vector<Trigram> out{};
+    if (str.size() < 3)
+        return out;
+
+    out.reserve(str.size() - 2);
+    Trigram t = 0;
+    for (size_t i = 0; i < str.size(); ++i)
+    {
+        unsigned char const ch = std::tolower(
+            static_cast<unsigned char>(str[i]));
+        t = ((t << 8) | ch) & 0xffffff;
+        if (i >= 2)
+            out.push_back(t);
+    }
+    std::sort(out.begin(), out.end());
+    out.erase(std::unique(out.begin(), out.end()), out.end());
+    return out;
+}
+
+
+std::vector<size_t> SearchIndex::_decode(Postings const &postings)
+{
+    std::vector<size_t> out{};
+    auto ptr = postings.data.data();
+    auto const end = ptr + postings.data.size();
+    size_t n = 0;
+    while (ptr != end)
+    {
+        n += get_varint(ptr);
+        out.push_back(n);
+    }
+    return out;
+}
+
+
+void SearchIndex::_prune()
+{
+    // Forget the older half of the indexed lines. Halving keeps pruning rare
+    // enough that its cost is spread over many added lines.
+    forget_before(_first + (_end - _first) / 2 + 1);
+}
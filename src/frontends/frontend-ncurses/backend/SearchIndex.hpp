@@ -0,0 +1,90 @@
+/* Copyright (C) 2023 Trevor Last
+ * See LICENSE file for copyright and license details.
+ */
+
+#ifndef FRONTENDNCURSES_SEARCHINDEX_HPP
+#define FRONTENDNCURSES_SEARCHINDEX_HPP
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+
+/**
+ * Case-insensitive trigram index over scrollback lines.
+ *
+ * Lines are identified by their line number, which must increase with each
+ * added line. For each trigram, the index keeps the sorted list of lines
+ * containing it, delta-encoded as varints. A query looks up the posting lists
+ * for each of its trigrams and intersects them, giving a list of candidate
+ * lines that the caller must still check.
+ *
+ * Memory use is bounded by a budget. When it is exceeded, postings for the
+ * oldest lines are discarded, so old lines stop being found. The indexed
+ * lines are always the range from 'first' to 'end'.
+ */
+class SearchIndex
+{
+public:
+    static constexpr size_t DEFAULT_BUDGET = 2 * 1024 * 1024;
+
+    SearchIndex(size_t budget=DEFAULT_BUDGET);
+
+    /** Index LINE as line number N. */
+    void add(size_t n, std::string_view line);
+    /**
+     * Discard postings for lines before N, which is also where indexing
+     * continues if it's past 'end'.
+     */
+    void forget_before(size_t n);
+
+    /**
+     * Lines which may contain QUERY, in ascending order. QUERY must be at
+     * least 3 bytes long.
+     */
+    std::vector<size_t> candidates(std::string_view query) const;
+
+    /** Lines before this are no longer indexed. */
+    size_t first() const {return _first;}
+    /** Line number after the last indexed line. */
+    size_t end() const {return _end;}
+    /** Approximate memory used by the index. */
+    size_t footprint() const {return _footprint;}
+    size_t budget() const {return _budget;}
+    /** Change the budget, discarding the oldest lines to fit if needed. */
+    void set_budget(size_t budget);
+
+    /** Save the index to PATH. Returns false on failure. */
+    bool save(std::string const &path) const;
+    /** Replace the index with one saved to PATH. Returns false on failure. */
+    bool load(std::string const &path);
+
+private:
+    using Trigram = std::uint32_t;
+
+    struct Postings
+    {
+        /** Varint-encoded line number deltas. */
+        std::vector<std::uint8_t> data{};
+        /** Last line number added, to compute the next delta. */
+        size_t last{0};
+    };
+
+    size_t _budget;
+    size_t _footprint{0};
+    size_t _first{0};
+    size_t _end{0};
+    std::unordered_map<Trigram, Postings> _postings{};
+
+    /** Unique case-folded trigrams in STR. */
+    static std::vector<Trigram> _trigrams(std::string_view str);
+    static std::vector<size_t> _decode(Postings const &postings);
+
+    /** Drop postings for the oldest lines until within budget. */
+    void _prune();
+};
+
+
+#endif
@@ -0,0 +1,178 @@
+/* Copyright (C) 2023 Trevor Last
+ * See LICENSE file for copyright and license details.
+ */
+
+#include "UserIndex.hpp"
+
+#include <algorithm>
+
+
+/** Rough per-node overhead of std::unordered_map. */
+static constexpr size_t NODE_OVERHEAD = 2 * sizeof(void *) + sizeof(size_t);
+
+
+UserIndex::UserIndex(CaseMapping mapping)
+:   _mapping{mapping}
+{
+}
+
+
+bool UserIndex::insert(std::string const &nick)
+{
+    auto const kv = _users.try_emplace(
+        casefold(nick, _mapping), Entry{User{nick}, 0});
+    if (!kv.second)
+        return false;
+    _append(*kv.first);
+    return true;
+}
+
+
+std::vector<UserIndex::User const *> UserIndex::insert_names(
+    std::vector<std::string_view> const &names)
+{
+    std::vector<User const *> added{};
+    _users.reserve(_users.size() + names.size());
+    _display.reserve(_display.size() + names.size());
+    for (auto name : names)
+    {
+        auto const nick_start = std::min(
+            name.find_first_not_of(MODE_PREFIXES),
+            name.size());
+        // A malformed reply may have a bare prefix, with no nick.
+        if (nick_start == name.size())
+            continue;
+        User user{
+            std::string{name.substr(nick_start)},
+            std::string{name.substr(0, nick_start)}};
+        auto key = casefold(user.nick, _mapping);
+
+        auto const kv = _users.try_emplace(
+            std::move(key), Entry{std::move(user), 0});
+        if (kv.second)
+        {
+            _append(*kv.first);
+            added.push_back(&kv.first->second.user);
+        }
+        else
+            kv.first->second.user.prefix = name.substr(0, nick_start);
+    }
+    return added;
+}
+
+
+void UserIndex::sort()
+{
+    if (_sorted_end == _display.size() && _gaps == 0)
+        return;
+    auto const by_key = [](auto a, auto b){return a->first < b->first;};
+    // Close the gaps in the sorted run and in the new users separately, so
+    // that only the new users need sorting.
+    auto const sorted_end = _display.begin() + _sorted_end;
+    auto const middle = std::remove(_display.begin(), sorted_end, nullptr);
+    auto const end = std::move(
+        sorted_end, std::remove(sorted_end, _display.end(), nullptr), middle);
+    std::sort(middle, end, by_key);
+    std::inplace_merge(_display.begin(), middle, end, by_key);
+    _display.erase(end, _display.end());
+    for (size_t i = 0; i < _display.size(); ++i)
+        _display[i]->second.slot = i;
+    _sorted_end = _display.size();
+    _gaps = 0;
+}
+
+
+bool UserIndex::erase(std::string const &nick)
+{
+    auto const it = _users.find(casefold(nick, _mapping));
+    if (it == _users.cend())
+        return false;
+    _display[it->second.slot] = nullptr;
+    ++_gaps;
+    _users.erase(it);
+    return true;
+}
+
+
+bool UserIndex::rename(std::string const &from, std::string const &to)
+{
+    auto const key = casefold(from, _mapping);
+    auto const it = _users.find(key);
+    if (it == _users.end())
+        return false;
+
+    // Only the case changed: the user keeps their place.
+    auto const to_key = casefold(to, _mapping);
+    if (to_key == key)
+    {
+        it->second.user.nick = to;
+        return true;
+    }
+    // Don't clobber a different user who already has the nick.
+    if (_users.count(to_key) != 0)
+        return false;
+
+    auto const prefix = it->second.user.prefix;
+    erase(from);
+    insert(to);
+    _users.at(to_key).user.prefix = prefix;
+    return true;
+}
+
+
+UserIndex::User const *UserIndex::find(std::string const &nick) const
+{
+    auto const it = _users.find(casefold(nick, _mapping));
+    return it == _users.cend()? nullptr : &it->second.user;
+}
+
+
+void UserIndex::set_casemapping(CaseMapping mapping)
+{
+    if (mapping == _mapping)
+        return;
+
+    auto users = std::move(_users);
+    _users.clear();
+    _display.clear();
+    _sorted_end = 0;
+    _gaps = 0;
+    _mapping = mapping;
+    for (auto &kv : users)
+    {
+        auto key = casefold(kv.second.user.nick, _mapping);
+        auto const inserted = _users.try_emplace(
+            std::move(key),
+            std::move(kv.second));
+        if (inserted.second)
+            _append(*inserted.first);
+    }
+    sort();
+}
+
+
+size_t UserIndex::footprint() const
+{
+    size_t total = sizeof(*this);
+    total += _users.bucket_count() * sizeof(void *);
+    total += _display.capacity() * sizeof(Display::value_type);
+    for (auto const &kv : _users)
+    {
+        total += NODE_OVERHEAD + sizeof(kv);
+        // Only count heap storage; short nicks fit in the string itself.
+        if (kv.first.capacity() > 15)
+            total += kv.first.capacity() + 1;
+        if (kv.second.user.nick.capacity() > 15)
+            total += kv.second.user.nick.capacity() + 1;
+    }
+    return total;
+}
+
+
+
+/* ==[ Private ]== */
+void UserIndex::_append(Users::value_type &kv)
+{
+    kv.second.slot = _display.size();
+    _display.push_back(&kv);
+}
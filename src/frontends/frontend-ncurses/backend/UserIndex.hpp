@@ -0,0 +1,112 @@
+/* Copyright (C) 2023 Trevor Last
+ * See LICENSE file for copyright and license details.
+ */
+
+#ifndef FRONTENDNCURSES_USERINDEX_HPP
+#define FRONTENDNCURSES_USERINDEX_HPP
+
+#include <util/strings.hpp>
+
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+
+/**
+ * A channel's user list.
+ *
+ * Users are looked up by their casefolded nick in a hash map, so adding,
+ * removing and finding a user is constant time, and nicks differing only in
+ * case (under the server's casemapping) are the same user. Alongside it is an
+ * array of the users sorted by folded nick, used for display.
+ *
+ * Adding a user only appends them to the display array, and removing one
+ * leaves a gap, so neither moves the other users. 'sort' closes the gaps and
+ * merges the new users in, in O(n + k log k) for k new users; call it before
+ * reading users in display order. A large NAMES reply is thus sorted once.
+ */
+class UserIndex
+{
+public:
+    struct User
+    {
+        std::string nick;
+        /** Channel mode prefixes, eg. "@" for an operator. */
+        std::string prefix{};
+    };
+
+    /** Channel mode prefixes which can appear before a nick in NAMES. */
+    static constexpr std::string_view MODE_PREFIXES = "~&@%+";
+
+    UserIndex(CaseMapping mapping=CaseMapping::RFC1459);
+
+    /**
+     * Add a user. The display order is not updated until 'sort' is called.
+     * Returns false if they were already present.
+     */
+    bool insert(std::string const &nick);
+    /**
+     * Add users from a NAMES list, stripping and keeping their mode prefixes;
+     * names that are only prefixes are skipped. The display order is not
+     * updated until 'sort' is called. Returns the users who weren't already
+     * present.
+     */
+    std::vector<User const *> insert_names(
+        std::vector<std::string_view> const &names);
+    /** Bring the display order up to date after users were added or removed. */
+    void sort();
+    /**
+     * Remove a user. The display order is not updated until 'sort' is
+     * called. Returns false if they weren't present.
+     */
+    bool erase(std::string const &nick);
+    /**
+     * Change a user's nick, keeping their mode prefix. Returns false if they
+     * weren't present, or if another user already has the new nick.
+     */
+    bool rename(std::string const &from, std::string const &to);
+    /** Get a user, or nullptr if they aren't present. */
+    User const *find(std::string const &nick) const;
+
+    size_t size() const {return _users.size();}
+    bool empty() const {return _users.empty();}
+
+    /** Get the Ith user in display order, as of the last 'sort'. */
+    User const &operator[](size_t i) const {return _display[i]->second.user;}
+
+    CaseMapping get_casemapping() const {return _mapping;}
+    /** Change the casemapping. Users who now collide are merged. */
+    void set_casemapping(CaseMapping mapping);
+
+    /** Approximate memory used by the index. */
+    size_t footprint() const;
+
+private:
+    struct Entry
+    {
+        User user;
+        /** Index in _display. */
+        size_t slot;
+    };
+    using Users = std::unordered_map<std::string, Entry>;
+    using Display = std::vector<Users::value_type *>;
+
+    CaseMapping _mapping;
+    /** Keyed by folded nick. Nodes never move, so _display can point in. */
+    Users _users{};
+    /**
+     * The first _sorted_end are sorted by folded nick; the rest were added
+     * since. Removed users leave nullptr behind.
+     */
+    Display _display{};
+    size_t _sorted_end{0};
+    /** Number of nullptr in _display. */
+    size_t _gaps{0};
+
+    /** Add KV, a new user, to the end of _display. */
+    void _append(Users::value_type &kv);
+};
+
+
+#endif
@@ -8,16 +8,20 @@
 #include <Backend.hpp>
 #include <Channel.hpp>
 #include <MessageHandler.hpp>
+#include <WrapLayout.hpp>
 
 #include <irc/Message.hpp>
 #include <util/Signal.hpp>
 
 #include <ncurses.h>
 
+#include <chrono>
 #include <string>
-#include <unordered_map>
+#include <vector>
 
 
+class LuaWorkers;
+
 /**
  * FrontendNCurses.
  *
@@ -29,6 +33,11 @@ class Frontend
 public:
     /** Emitted when user input has an IRC message ready to be sent. */
     Signal<void(Message)> signal_input_available{};
+    /**
+     * Emitted with when 'timers' should next be called, whenever that
+     * changes; time_point::max() for never.
+     */
+    Signal<void(std::chrono::steady_clock::time_point)> signal_timers_due{};
 
     Frontend();
     ~Frontend();
@@ -38,16 +47,66 @@ public:
 
     /** Process available IRC messages from CLIENT. */
     void process_message(Message const &message);
+    /** Process a burst of IRC messages recieved together, in order. */
+    void process_messages(std::vector<Message> const &messages);
+
+    /** File descriptors to watch for reading, for 'watch_fd_ready'. */
+    std::vector<int> get_watch_fds() const;
+    /** Process a watched file descriptor. Returns true on error/EOF. */
+    bool watch_fd_ready(int fd);
+
+    /** Do background work when idle. Returns true if there is more. */
+    bool idle();
+
+    /** Run the Lua timers that are due. */
+    void timers();
+
+    /** The IRC connection closed: drop the Lua handlers waiting for replies. */
+    void disconnected();
 
 private:
+    /** Default /profile sampling interval, in Lua instructions. */
+    static constexpr int PROFILE_SAMPLE_INTERVAL = 1000;
+    /** Commands and functions /profile lists. */
+    static constexpr size_t PROFILE_SHOWN = 8;
+
     std::string _buffer{};
 
     Backend _backend{};
-    std::unique_ptr<FrontendMessageHandler> _message_handler;
+    std::unique_ptr<FrontendMessageHandler> _message_handler{};
+    /**
+     * Runs the handlers instead of _message_handler when IRCC_LUA_WORKERS
+     * is set to the number of worker threads.
+     */
+    std::unique_ptr<LuaWorkers> _workers{};
+    size_t _worker_count{0};
+    /** Written to by the workers when they have changes to apply. */
+    int _worker_fd{-1};
+    /** inotify watch on scripts/, or -1. */
+    int _scripts_fd{-1};
+    /** Set by /restart, which can't run with the backend locked. */
+    bool _rebuild_pending{false};
+    /** When 'signal_timers_due' last said to call 'timers'. */
+    std::chrono::steady_clock::time_point _timers_due{
+        std::chrono::steady_clock::time_point::max()};
+
+    /** Word-wrap layout of each channel's scrollback, by channel ID. */
+    std::vector<WrapLayout> _layouts{};
 
     size_t _channels_offset{0};
     size_t _users_offset{0};
 
+    /** A search match: channel ID and absolute scrollback line number. */
+    struct SearchHit
+    {
+        ChannelId channel;
+        size_t line;
+    };
+    std::vector<SearchHit> _search_hits{};
+    size_t _search_pos{0};
+    /** Shown on the input window's border. */
+    std::string _status{};
+
     WINDOW *_channelw{nullptr};
     WINDOW *_main{nullptr};
     WINDOW *_userw{nullptr};
@@ -57,9 +116,56 @@ private:
 
     // input controls
     void _backspace();
-    void _add_character(char ch);
+    void _add_character(wchar_t ch);
+
+    /** Create the message handler, or the workers. */
+    void _load_scripts();
+    /**
+     * Stop the workers, if any, applying what they did with the messages
+     * they were handed. The backend must not be locked.
+     */
+    void _stop_workers();
+    /**
+     * Start the scripts afresh in new Lua states. The backend must not be
+     * locked.
+     */
+    void _rebuild();
+    /**
+     * Re-run the scripts at PATHS in place, or have the workers do so. The
+     * backend must be locked.
+     */
+    void _reload(std::vector<std::string> const &paths);
+    /** Start watching scripts/, so changed scripts are reloaded in place. */
+    void _watch_scripts();
+    /** Reload the scripts changed since last time. */
+    void _scripts_changed();
+    /** Emit 'signal_timers_due' if the next timer has changed. */
+    void _schedule_timers();
+
+    /** Get the word-wrap layout for CHANNEL. */
+    WrapLayout &_layout(Channel const &channel);
+    /** Scroll the main window up by ROWS wrapped rows (down if negative). */
+    void _scroll_main(int rows);
 
     void _handle_user_input(std::string const &line);
+    /**
+     * /profile [sample [N] | reset | dump FILE]: show the handler profile,
+     * sample every N Lua instructions (0 to stop), clear it, or write all of
+     * it to FILE.
+     */
+    void _profile(std::string const &args);
+    /**
+     * /budget [[COMMAND] MS]: show the handler time budgets and quarantined
+     * commands, or set COMMAND's budget or the default to MS (0 for none).
+     */
+    void _budget(std::string const &args);
+    /** Find QUERY in all channels and jump to the newest match. */
+    void _search(std::string const &query);
+    /** Jump to the next search match. */
+    void _search_next();
+
+    /** Fit the windows to the terminal size. */
+    void _resize();
 
     void _draw_channels();
     void _draw_main();
@@ -3,17 +3,45 @@
  */
 
 #include "Frontend.hpp"
+#include "LuaWorkers.hpp"
 
 #include <util/debug.hpp>
 #include <util/strings.hpp>
+#include <util/utf8.hpp>
 
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include <algorithm>
 #include <cctype>
+#include <cerrno>
+#include <chrono>
 #include <clocale>
+#include <cstdlib>
+#include <cstring>
+#include <cwctype>
+#include <fstream>
+#include <set>
+#include <system_error>
 
 
 Frontend::Frontend()
-:   _message_handler{new FrontendMessageHandler{}}
 {
+    if (auto const workers = std::getenv("IRCC_LUA_WORKERS"))
+        _worker_count = std::strtoul(workers, nullptr, 10);
+    if (_worker_count > 0)
+    {
+        _worker_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (_worker_fd == -1)
+        {
+            throw std::system_error{
+                errno, std::generic_category(), "eventfd()"};
+        }
+    }
+    _load_scripts();
+    _watch_scripts();
+
     setlocale(LC_ALL, "");
     initscr();
     cbreak();
@@ -25,12 +53,11 @@ Frontend::Frontend()
     _backend.signal_response_ready.connect(
         [this](Message const &msg){signal_input_available.emit(msg);});
 
-    int height, width;
-    getmaxyx(stdscr, height, width);
-    _channelw = newwin(height, 9, 0, 0);
-    _main = newwin(height-2, width-9-10, 0, 9);
-    _userw = newwin(height, 10, 0, width-10);
-    _input = newwin(2, width-9-10, height-2, 9);
+    _channelw = newwin(1, 1, 0, 0);
+    _main = newwin(1, 1, 0, 0);
+    _userw = newwin(1, 1, 0, 0);
+    _input = newwin(1, 1, 0, 0);
+    _resize();
 
     _draw();
 }
@@ -38,6 +65,12 @@ Frontend::Frontend()
 
 Frontend::~Frontend()
 {
+    _stop_workers();
+    if (_worker_fd != -1)
+        close(_worker_fd);
+    if (_scripts_fd != -1)
+        close(_scripts_fd);
+
     delwin(_main);
     delwin(_input);
     endwin();
@@ -46,9 +79,18 @@ Frontend::~Frontend()
 
 bool Frontend::input()
 {
-    int ch;
-    while ((ch = getch()) != ERR)
+    std::unique_lock<std::shared_mutex> lock{_backend.get_mutex()};
+    wint_t ch;
+    int status;
+    while ((status = get_wch(&ch)) != ERR)
     {
+        if (status == OK && ch != '\n')
+        {
+            if (iswprint(ch))
+                _add_character(ch);
+            continue;
+        }
+
         switch (ch)
         {
         case KEY_ENTER:
@@ -61,15 +103,19 @@ bool Frontend::input()
             _backspace();
             break;
 
+        case KEY_RESIZE:
+            _resize();
+            break;
+
         case KEY_MOUSE:{
             MEVENT event;
             getmouse(&event);
             if (wenclose(_main, event.y, event.x))
             {
                 if (event.bstate & BUTTON4_PRESSED)
-                    _backend.get_active_channel().scroll_up(1);
+                    _scroll_main(1);
                 if (event.bstate & BUTTON5_PRESSED)
-                    _backend.get_active_channel().scroll_down(1);
+                    _scroll_main(-1);
             }
             if (wenclose(_channelw, event.y, event.x))
             {
@@ -100,51 +146,337 @@ bool Frontend::input()
                 }
             }
             break;}
-
-        default:
-            if (isascii(ch))
-                _add_character(ch);
-            break;
         }
     }
     _draw();
+    lock.unlock();
+
+    if (_rebuild_pending)
+        _rebuild();
+    _schedule_timers();
     return false;
 }
 
 
 void Frontend::process_message(Message const &msg)
 {
+    if (_workers)
+    {
+        _workers->dispatch({msg});
+        return;
+    }
     _message_handler->execute(_backend, msg);
     _draw();
+    _schedule_timers();
 }
 
 
+void Frontend::process_messages(std::vector<Message> const &messages)
+{
+    if (_workers)
+    {
+        _workers->dispatch(messages);
+        return;
+    }
+    _message_handler->execute(_backend, messages);
+    _draw();
+    _schedule_timers();
+}
 
-std::string Frontend::clip(std::string const &string, size_t width)
+
+std::vector<int> Frontend::get_watch_fds() const
 {
-    std::string normalized{};
-    for (auto ch : string)
-        if (isprint(ch))
-            normalized.push_back(ch);
+    std::vector<int> fds{};
+    for (auto const fd : {_worker_fd, _scripts_fd})
+        if (fd != -1)
+            fds.push_back(fd);
+    return fds;
+}
 
-    auto clipped = normalized.substr(0, width);
-    if (normalized.size() > width)
-        clipped.back() = '-';
 
-    return clipped;
+bool Frontend::watch_fd_ready(int fd)
+{
+    if (fd == _worker_fd && _workers)
+    {
+        std::unique_lock<std::shared_mutex> lock{_backend.get_mutex()};
+        _workers->apply();
+        _draw();
+    }
+    else if (fd == _scripts_fd)
+        _scripts_changed();
+    _schedule_timers();
+    return false;
+}
+
+
+bool Frontend::idle()
+{
+    // Workers collect their own garbage.
+    if (_workers)
+        return false;
+    return _message_handler->collect_garbage(
+        FrontendMessageHandler::GC_BUDGET);
+}
+
+
+void Frontend::timers()
+{
+    // The timer that called this has fired.
+    _timers_due = std::chrono::steady_clock::time_point::max();
+    if (_workers)
+        _workers->run_timers();
+    else
+    {
+        _message_handler->run_timers(_backend);
+        _draw();
+    }
+    _schedule_timers();
+}
+
+
+void Frontend::disconnected()
+{
+    if (_workers)
+        _workers->drop_waiters();
+    else
+        _message_handler->drop_waiters();
+    _schedule_timers();
+}
+
+
+std::string Frontend::clip(std::string const &string, size_t width)
+{
+    auto const text = utf8_sanitize(string);
+
+    // Byte offset where the text reaches WIDTH-1 columns, leaving room for
+    // the '-' marking that it was clipped.
+    size_t fit = 0;
+    size_t column = 0;
+    for (size_t i = 0; i < text.size(); )
+    {
+        column += codepoint_width(utf8_decode(text, i));
+        if (column > width)
+            return text.substr(0, fit) + (width > 0? "-" : "");
+        if (column < width)
+            fit = i;
+    }
+    return text;
 }
 
 
 void Frontend::_backspace()
 {
-    if (!_buffer.empty())
+    // Remove the whole last code point, not just its last byte.
+    while (!_buffer.empty())
+    {
+        unsigned char const ch = _buffer.back();
         _buffer.pop_back();
+        if ((ch & 0xc0) != 0x80)
+            break;
+    }
+}
+
+
+void Frontend::_add_character(wchar_t ch)
+{
+    utf8_append(_buffer, ch);
+}
+
+
+void Frontend::_load_scripts()
+{
+    if (_worker_fd == -1)
+    {
+        _message_handler.reset(new FrontendMessageHandler{});
+        return;
+    }
+    _stop_workers();
+    _workers.reset(new LuaWorkers{_backend, _worker_count, _worker_fd});
 }
 
 
-void Frontend::_add_character(char ch)
+void Frontend::_stop_workers()
 {
-    _buffer.push_back(ch);
+    if (!_workers)
+        return;
+    _workers->stop();
+    {
+        std::unique_lock<std::shared_mutex> lock{_backend.get_mutex()};
+        _workers->apply();
+    }
+    _workers.reset();
+}
+
+
+void Frontend::_rebuild()
+{
+    // Workers may be waiting to read the backend, so it must be unlocked
+    // while they're stopped.
+    _rebuild_pending = false;
+    _load_scripts();
+    debugstream << "=== scripts restarted" << std::endl;
+
+    std::unique_lock<std::shared_mutex> lock{_backend.get_mutex()};
+    for (auto const &channel : _backend.get_channels())
+        channel->push_message("=== scripts restarted ===");
+    _draw();
+}
+
+
+void Frontend::_reload(std::vector<std::string> const &paths)
+{
+    if (_workers)
+    {
+        for (auto const &path : paths)
+            _workers->reload(path);
+        return;
+    }
+
+    for (auto const &path : paths)
+    {
+        auto const result = _message_handler->reload(path);
+        if (result.empty())
+            continue;
+        debugstream << result << std::endl;
+        _backend.get_active_channel().push_message(result);
+    }
+}
+
+
+void Frontend::_watch_scripts()
+{
+    // Editors often save by writing a new file and renaming it over the old.
+    _scripts_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (_scripts_fd != -1
+        && inotify_add_watch(
+            _scripts_fd, "scripts", IN_CLOSE_WRITE | IN_MOVED_TO) != -1)
+        return;
+
+    debugstream << "!!Not watching scripts/ for changes: "
+        << std::strerror(errno) << std::endl;
+    if (_scripts_fd != -1)
+        close(_scripts_fd);
+    _scripts_fd = -1;
+}
+
+
+void Frontend::_scripts_changed()
+{
+    // Several events can arrive for one save; each script runs once.
+    std::vector<std::string> changed{};
+    alignas(inotify_event) char buf[4096];
+    for (;;)
+    {
+        auto const n = read(_scripts_fd, buf, sizeof(buf));
+        if (n == -1 && errno != EAGAIN)
+            throw std::system_error{errno, std::generic_category(), "read()"};
+        if (n <= 0)
+            break;
+        for (auto p = buf; p < buf + n; )
+        {
+            auto const event = reinterpret_cast<inotify_event const *>(p);
+            p += sizeof(inotify_event) + event->len;
+            if (event->len == 0)
+                continue;
+            auto const path = std::string{"scripts/"} + event->name;
+            if (std::find(changed.cbegin(), changed.cend(), path)
+                == changed.cend())
+                changed.push_back(path);
+        }
+    }
+
+    std::unique_lock<std::shared_mutex> lock{_backend.get_mutex()};
+    _reload(changed);
+    _draw();
+}
+
+
+void Frontend::_schedule_timers()
+{
+    auto const due = _workers?
+        _workers->next_timer() : _message_handler->next_timer();
+    if (due == _timers_due)
+        return;
+    _timers_due = due;
+    signal_timers_due.emit(due);
+}
+
+
+WrapLayout &Frontend::_layout(Channel const &channel)
+{
+    if (channel.id >= _layouts.size())
+        _layouts.resize(channel.id + 1);
+    return _layouts[channel.id];
+}
+
+
+void Frontend::_scroll_main(int rows)
+{
+    auto &active = _backend.get_active_channel();
+    auto const &scrollback = active.get_scrollback();
+    auto &layout = _layout(active);
+    int const width = getmaxx(_main);
+
+    auto const size = scrollback.size();
+    if (size == 0)
+        return;
+
+    auto offset = std::min(active.get_scrollback_offset(), size - 1);
+    auto row = active.get_scrollback_row();
+    auto const rows_at = [&](size_t offset){
+        auto const i = size - 1 - offset;
+        auto const n = scrollback.dropped() + i;
+        return layout.get(n, scrollback[i], scrollback.width(i), width).rows();
+    };
+
+    for (; rows > 0; --rows)
+    {
+        if (row + 1 < rows_at(offset))
+            row++;
+        else if (offset + 1 < size)
+        {
+            offset++;
+            row = 0;
+        }
+        else
+            break;
+    }
+    for (; rows < 0; ++rows)
+    {
+        if (row > 0)
+            row--;
+        else if (offset > 0)
+        {
+            offset--;
+            row = rows_at(offset) - 1;
+        }
+        else
+            break;
+    }
+    active.set_scrollback_position(offset, row);
+}
+
+
+void Frontend::_resize()
+{
+    int height, width;
+    getmaxyx(stdscr, height, width);
+    int const middle = std::max(1, width-9-10);
+
+    wresize(_channelw, height, 9);
+    wresize(_main, std::max(1, height-2), middle);
+    wresize(_userw, height, 10);
+    wresize(_input, 2, middle);
+
+    mvwin(_channelw, 0, 0);
+    mvwin(_main, 0, 9);
+    mvwin(_userw, 0, width-10);
+    mvwin(_input, height-2, 9);
+
+    // Wrap layouts notice the new width themselves, and only lay out the
+    // lines that are drawn.
+    clear();
+    refresh();
 }
 
 
@@ -165,19 +497,17 @@ void Frontend::_draw_channels()
     mvwaddstr(_channelw, 0, 0, clip("CHANNELS", width-1).c_str());
 
     auto const &active = _backend.get_active_channel();
-    auto const channels = _backend.get_channels();
-    auto it = channels.cbegin();
+    auto const &channels = _backend.get_channels();
 
-    for (size_t i = 0; i < _channels_offset && it != channels.cend(); ++i)
-        it++;
-
-    for (int y = 0; y < height && it != channels.cend(); ++y, ++it)
+    auto i = _channels_offset;
+    for (int y = 0; y < height && i < channels.size(); ++y, ++i)
     {
-        if (it->second.name == active.name)
+        auto const &channel = *channels[i];
+        if (&channel == &active)
             wattrset(_channelw, A_REVERSE);
         else
             wattrset(_channelw, A_NORMAL);
-        auto const str = clip(it->second.name, width-1);
+        auto const str = clip(channel.name, width-1);
         mvwaddstr(_channelw, 1+y, 0, str.c_str());
     }
 }
@@ -187,30 +517,51 @@ void Frontend::_draw_main()
 {
     auto const &active = _backend.get_active_channel();
     auto const &scrollback = active.get_scrollback();
+    auto &layout = _layout(active);
     int const height = getmaxy(_main);
     int const width = getmaxx(_main);
 
     werase(_main);
 
-    int y = 1;
-    auto it = scrollback.crbegin();
+    if (active.get_scrollback_offset() >= scrollback.size())
+        return;
 
-    for (size_t i = 0; i < active.get_scrollback_offset(); ++i)
-        it++;
+    // Absolute line number of the current search match in this channel.
+    auto hit = SIZE_MAX;
+    if (!_search_hits.empty())
+    {
+        auto const &h = _search_hits.at(_search_pos);
+        if (h.channel == active.id)
+            hit = h.line;
+    }
 
-    while (it != scrollback.crend() && y <= height)
+    // Index of the line drawn at the bottom of the window.
+    size_t i = scrollback.size() - 1 - active.get_scrollback_offset();
+    // Rows of that line which are scrolled off the bottom.
+    size_t hidden = active.get_scrollback_row();
+
+    for (int y = height; y > 0; )
     {
-        wmove(_main, height - y, 0);
-        for (auto const ch : *it)
+        auto const n = scrollback.dropped() + i;
+        auto const text = scrollback[i];
+        auto const &line = layout.get(n, text, scrollback.width(i), width);
+
+        if (n == hit)
+            wattrset(_main, A_REVERSE);
+        else
+            wattrset(_main, A_NORMAL);
+
+        hidden = std::min(hidden, line.rows() - 1);
+        for (size_t r = line.rows() - hidden; r > 0 && y > 0; --r)
         {
-            if (getcurx(_main)+1 > width)
-                break;
-            if (isprint(ch))
-                waddch(_main, ch);
+            auto const row = line.row(text, r - 1);
+            mvwaddnstr(_main, --y, 0, row.data(), row.size());
         }
+        hidden = 0;
 
-        it++;
-        y++;
+        if (i == 0)
+            break;
+        i--;
     }
 }
 
@@ -230,15 +581,14 @@ void Frontend::_draw_users()
     // Title
     mvwaddstr(_userw, 0, 1, clip("USERS", width-1).c_str());
 
-    auto const users = active.get_users();
-    auto it = users.cbegin();
+    active.sort_users();
+    auto const &users = active.get_users();
+    size_t i = _users_offset;
 
-    for (size_t i = 0; i < _users_offset && it != users.cend(); ++i)
-        it++;
-
-    for (int y = 0; y < height && it != users.cend(); ++y, ++it)
+    for (int y = 0; y < height && i < users.size(); ++y, ++i)
     {
-        auto const str = clip(*it, width-1);
+        auto const &user = users[i];
+        auto const str = clip(user.prefix + user.nick, width-1);
         mvwaddstr(_userw, 1+y, 1, str.c_str());
     }
 }
@@ -249,6 +599,8 @@ void Frontend::_draw_input()
     int const width = getmaxx(_input);
     werase(_input);
     mvwhline(_input, 0, 0, ACS_HLINE, width);
+    if (!_status.empty())
+        mvwaddstr(_input, 0, 1, clip(" " + _status + " ", width-2).c_str());
     mvwaddstr(_input, 1, 0, _buffer.c_str());
 }
 
@@ -271,6 +623,7 @@ void Frontend::_handle_user_input(std::string const &line)
     if (line.empty())
         return;
 
+    _status.clear();
     if (line.at(0) != '/')
     {
         auto const channel = _backend.get_active_channel().name;
@@ -282,13 +635,12 @@ void Frontend::_handle_user_input(std::string const &line)
         auto const cmdL = lowercase(cmd);
         if (cmdL == "reload")
         {
-            _message_handler.reset(new FrontendMessageHandler{});
-            debugstream << "=== scripts reloaded" << std::endl;
-            for (auto &kv : _backend.get_channels())
-            {
-                auto channel = kv.second;
-                channel.push_message("=== scripts reloaded ===");
-            }
+            _reload(FrontendMessageHandler::scripts());
+        }
+        else if (cmdL == "restart")
+        {
+            // Done once input() unlocks the backend; see _rebuild.
+            _rebuild_pending = true;
         }
         else if (cmdL.find("channel") == 0)
         {
@@ -308,9 +660,266 @@ void Frontend::_handle_user_input(std::string const &line)
                     "=== /channel: channel '" + arg + "' does not exist");
             }
         }
+        else if (cmdL == "search")
+        {
+            _search_next();
+        }
+        else if (cmdL.find("search ") == 0)
+        {
+            _search(cmd.substr(7));
+        }
+        else if (cmdL == "users")
+        {
+            auto &active = _backend.get_active_channel();
+            auto const &users = active.get_users();
+            auto const bytes = users.footprint();
+            active.push_message(
+                "=== " + active.name + ": "
+                + std::to_string(users.size()) + " users, "
+                + std::to_string(bytes) + " bytes ("
+                + std::to_string(users.empty()? 0 : bytes / users.size())
+                + " per user)");
+        }
+        else if (cmdL == "dispatch")
+        {
+            auto const stats = _workers?
+                _workers->get_stats() : _message_handler->get_stats();
+            auto const us = std::chrono::duration<double, std::micro>{
+                stats.time}.count();
+            auto const worst_ms = std::chrono::duration<double, std::milli>{
+                stats.worst}.count();
+            _backend.get_active_channel().push_message(
+                "=== dispatch: " + std::to_string(stats.messages)
+                + " messages (" + std::to_string(stats.unhandled)
+                + " unhandled, " + std::to_string(stats.native)
+                + " built-in), " + std::to_string(stats.calls)
+                + " handler calls (" + std::to_string(stats.aborted)
+                + " aborted, " + std::to_string(stats.waiting)
+                + " waiting), " + std::to_string(stats.timer_calls)
+                + " timer calls (" + std::to_string(stats.timers)
+                + " pending), "
+                + std::to_string(stats.messages? us / stats.messages : 0.0)
+                + "us per message, worst " + std::to_string(worst_ms) + "ms");
+        }
+        else if (cmdL.find("profile") == 0)
+        {
+            auto const i = cmd.find(' ');
+            _profile(i == std::string::npos? "" : cmd.substr(i+1));
+        }
+        else if (cmdL.find("budget") == 0)
+        {
+            auto const i = cmd.find(' ');
+            _budget(i == std::string::npos? "" : cmd.substr(i+1));
+        }
+        else if (cmdL == "scrollback")
+        {
+            auto &active = _backend.get_active_channel();
+            for (auto const &channel : _backend.get_channels())
+            {
+                auto const &scrollback = channel->get_scrollback();
+                active.push_message(
+                    "=== " + channel->name + ": "
+                    + std::to_string(scrollback.size()) + " lines, "
+                    + std::to_string(scrollback.bytes()) + " bytes used, "
+                    + std::to_string(scrollback.footprint()) + " bytes held");
+            }
+        }
         else
         {
             signal_input_available.emit(Message{cmd});
         }
     }
 }
+
+
+void Frontend::_profile(std::string const &args)
+{
+    std::vector<LuaProfiler *> profilers{};
+    if (_workers)
+        profilers = _workers->get_profilers();
+    else
+        profilers.push_back(&_message_handler->get_profiler());
+
+    auto const i = args.find(' ');
+    auto const sub = lowercase(args.substr(0, i));
+    auto const arg = i == std::string::npos? "" : args.substr(i+1);
+    auto &active = _backend.get_active_channel();
+
+    if (sub == "sample")
+    {
+        auto const interval = arg.empty()?
+            PROFILE_SAMPLE_INTERVAL : std::atoi(arg.c_str());
+        for (auto const profiler : profilers)
+            profiler->set_sampling(interval);
+        _status = interval > 0?
+            "sampling every " + std::to_string(interval) + " instructions"
+            : "not sampling";
+        return;
+    }
+    if (sub == "reset")
+    {
+        for (auto const profiler : profilers)
+            profiler->reset();
+        _status = "profile reset";
+        return;
+    }
+
+    LuaProfiler::Profile profile{};
+    for (auto const profiler : profilers)
+        profile.merge(profiler->snapshot());
+
+    if (sub == "dump")
+    {
+        if (arg.empty())
+        {
+            _status = "/profile dump: missing file name";
+            return;
+        }
+        std::ofstream out{arg};
+        for (auto const &line : profile.report())
+            out << line << '\n';
+        out.close();
+        _status = out? "profile written to " + arg : "couldn't write " + arg;
+        return;
+    }
+    if (!sub.empty())
+    {
+        _status = "/profile: unknown subcommand '" + sub + "'";
+        return;
+    }
+
+    active.push_message("=== profile: busiest handlers");
+    if (LuaAllocator::ENABLED)
+    {
+        auto const memory = _workers?
+            _workers->get_memory() : _message_handler->get_memory();
+        active.push_message(
+            "=== Lua memory: " + std::to_string(memory.live) + " bytes live, "
+            + std::to_string(memory.peak) + " peak, limit "
+            + (memory.limit? std::to_string(memory.limit) : "none"));
+    }
+    for (auto const &line : profile.report(PROFILE_SHOWN))
+        active.push_message("=== " + line);
+}
+
+
+void Frontend::_budget(std::string const &args)
+{
+    std::vector<LuaWatchdog *> watchdogs{};
+    if (_workers)
+        watchdogs = _workers->get_watchdogs();
+    else
+        watchdogs.push_back(&_message_handler->get_watchdog());
+
+    auto const i = args.find(' ');
+    if (!args.empty())
+    {
+        auto const name = (i == std::string::npos)?
+            "" : lowercase(args.substr(0, i));
+        auto const ms = args.substr(i == std::string::npos? 0 : i+1);
+        if (ms.empty() || !std::all_of(ms.cbegin(), ms.cend(), ::isdigit))
+        {
+            _status = "/budget: '" + ms + "' is not a number of ms";
+            return;
+        }
+        LuaWatchdog::Budget const budget{std::atoll(ms.c_str())};
+        for (auto const watchdog : watchdogs)
+            watchdog->set_budget(name, budget);
+        _status = (name.empty()? "default" : name) + " budget: "
+            + (budget.count()? ms + "ms" : "none");
+        return;
+    }
+
+    auto &active = _backend.get_active_channel();
+    for (auto const &kv : watchdogs.front()->get_budgets())
+    {
+        active.push_message(
+            "=== budget " + (kv.first.empty()? "(default)" : kv.first) + ": "
+            + (kv.second.count()?
+                std::to_string(kv.second.count()) + "ms" : "none"));
+    }
+    std::set<std::string> quarantined{};
+    for (auto const watchdog : watchdogs)
+    {
+        auto const q = watchdog->get_quarantined();
+        quarantined.insert(q.cbegin(), q.cend());
+    }
+    for (auto const &name : quarantined)
+        active.push_message("=== quarantined: " + name);
+}
+
+
+void Frontend::_search(std::string const &query)
+{
+    auto const start = std::chrono::steady_clock::now();
+
+    _search_hits.clear();
+    _search_pos = 0;
+    size_t unindexed = 0;
+    for (auto const &channel : _backend.get_channels())
+    {
+        auto const dropped = channel->get_scrollback().dropped();
+        for (auto const i : channel->search(query))
+            _search_hits.push_back({channel->id, dropped + i});
+        if (query.size() >= 3)
+            unindexed += channel->unindexed();
+    }
+
+    // Line numbers only order lines within a channel, so the matches are
+    // grouped by channel, the active one first and then in the order they
+    // were added, each newest first.
+    auto const active = _backend.get_active_channel().id;
+    std::sort(
+        _search_hits.begin(), _search_hits.end(),
+        [&](SearchHit const &a, SearchHit const &b){
+            bool const a_active = a.channel == active;
+            bool const b_active = b.channel == active;
+            if (a_active != b_active)
+                return a_active;
+            if (a.channel != b.channel)
+                return a.channel < b.channel;
+            return a.line > b.line;
+        });
+    auto const note = unindexed == 0? std::string{} : (
+        " (" + std::to_string(unindexed) + " older lines not indexed)");
+
+    auto const elapsed = std::chrono::duration<double, std::milli>{
+        std::chrono::steady_clock::now() - start};
+    debugstream << "=== /search '" << query << "': " << _search_hits.size()
+        << " matches in " << elapsed.count() << "ms" << std::endl;
+
+    if (_search_hits.empty())
+    {
+        _status = "no matches for '" + query + "'" + note;
+        return;
+    }
+    _search_pos = _search_hits.size() - 1;
+    _search_next();
+    _status += note;
+}
+
+
+void Frontend::_search_next()
+{
+    if (_search_hits.empty())
+    {
+        _status = "/search: no search";
+        return;
+    }
+
+    _search_pos = (_search_pos + 1) % _search_hits.size();
+    auto const &hit = _search_hits.at(_search_pos);
+    _backend.set_active_channel(hit.channel);
+
+    auto &channel = _backend.get_active_channel();
+    auto const dropped = channel.get_scrollback().dropped();
+    if (hit.line < dropped)
+    {
+        _status = "/search: match has left the scrollback";
+        return;
+    }
+    channel.scroll_to(hit.line - dropped);
+    _status = (
+        "match " + std::to_string(_search_pos + 1)
+        + "/" + std::to_string(_search_hits.size()));
+}
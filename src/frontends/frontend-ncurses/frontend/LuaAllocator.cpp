@@ -0,0 +1,199 @@
+/* Copyright (C) 2023 Trevor Last
+ * See LICENSE file for copyright and license details.
+ */
+
+#include "LuaAllocator.hpp"
+
+#include <util/debug.hpp>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+
+#ifdef IRCC_LUAJIT
+bool const LuaAllocator::ENABLED = false;
+#else
+bool const LuaAllocator::ENABLED = true;
+#endif
+
+
+static int panic(lua_State *L)
+{
+    auto const errmsg = lua_tostring(L, -1);
+    debugstream << "!!Lua panic: " << (errmsg? errmsg : "?") << std::endl;
+    return 0;
+}
+
+
+
+LuaAllocator::LuaAllocator(size_t limit)
+:   _limit{limit}
+{
+}
+
+
+LuaAllocator::~LuaAllocator()
+{
+    for (auto const chunk : _chunks)
+        std::free(chunk);
+}
+
+
+lua_State *LuaAllocator::new_state()
+{
+#ifdef IRCC_LUAJIT
+    auto const L = luaL_newstate();
+#else
+    auto const L = lua_newstate(_alloc, this);
+#endif
+    if (L)
+        lua_atpanic(L, panic);
+    return L;
+}
+
+
+LuaAllocator::Stats LuaAllocator::get_stats() const
+{
+    return {
+        _live.load(std::memory_order_relaxed),
+        _peak.load(std::memory_order_relaxed),
+        _limit};
+}
+
+
+
+/* ==[ Private ]== */
+size_t LuaAllocator::_footprint(size_t size)
+{
+    if (size == 0 || size > MAX_POOLED)
+        return size;
+    return (_class(size) + 1) * GRANULE;
+}
+
+
+void *LuaAllocator::_pool_alloc(size_t cls)
+{
+    if (auto const block = _free[cls])
+    {
+        _free[cls] = block->next;
+        return block;
+    }
+
+    size_t const size = (cls + 1) * GRANULE;
+    if (static_cast<size_t>(_bump_end - _bump) < size)
+    {
+        auto const chunk = static_cast<char *>(std::malloc(CHUNK_SIZE));
+        if (!chunk)
+            return nullptr;
+        _chunks.push_back(chunk);
+
+        // Hand what's left of the old chunk out to the free lists.
+        while (_bump_end - _bump >= static_cast<ptrdiff_t>(GRANULE))
+        {
+            auto const left = static_cast<size_t>(_bump_end - _bump);
+            auto const fit = std::min(left / GRANULE, CLASSES) - 1;
+            auto const block = reinterpret_cast<Block *>(_bump);
+            block->next = _free[fit];
+            _free[fit] = block;
+            _bump += (fit + 1) * GRANULE;
+        }
+        _bump = chunk;
+        _bump_end = chunk + CHUNK_SIZE;
+    }
+    auto const block = _bump;
+    _bump += size;
+    return block;
+}
+
+
+void LuaAllocator::_free_block(void *ptr, size_t size)
+{
+    if (size > MAX_POOLED)
+    {
+        std::free(ptr);
+        return;
+    }
+    auto const block = static_cast<Block *>(ptr);
+    auto const cls = _class(size);
+    block->next = _free[cls];
+    _free[cls] = block;
+}
+
+
+void *LuaAllocator::_realloc(void *ptr, size_t osize, size_t nsize)
+{
+    // OSIZE is a type tag, not a size, when PTR is null.
+    if (!ptr)
+        osize = 0;
+    auto const live = _live.load(std::memory_order_relaxed);
+    auto const old_footprint = _footprint(osize);
+    auto const new_footprint = _footprint(nsize);
+
+    if (nsize == 0)
+    {
+        if (ptr)
+            _free_block(ptr, osize);
+        _live.store(live - old_footprint, std::memory_order_relaxed);
+        return nullptr;
+    }
+    if (_limit
+        && new_footprint > old_footprint
+        && live - old_footprint + new_footprint
+            > _limit + (_strict? 0 : HOST_HEADROOM))
+        return nullptr;
+
+    void *block = nullptr;
+    if (ptr && old_footprint == new_footprint && nsize <= MAX_POOLED)
+        block = ptr;
+    else if (ptr && osize > MAX_POOLED && nsize > MAX_POOLED)
+        block = std::realloc(ptr, nsize);
+    else
+    {
+        block = (nsize <= MAX_POOLED)?
+            _pool_alloc(_class(nsize)) : std::malloc(nsize);
+        if (block && ptr)
+        {
+            std::memcpy(block, ptr, std::min(osize, nsize));
+            _free_block(ptr, osize);
+        }
+    }
+    if (!block)
+    {
+        // Lua can't handle shrinking failing, but this can only happen when
+        // the process is out of memory anyway.
+        if (nsize <= osize)
+            std::abort();
+        return nullptr;
+    }
+
+    if (nsize > osize)
+        _allocated += nsize - osize;
+    auto const now = live - old_footprint + new_footprint;
+    _live.store(now, std::memory_order_relaxed);
+    if (now > _peak.load(std::memory_order_relaxed))
+        _peak.store(now, std::memory_order_relaxed);
+    return block;
+}
+
+
+void *LuaAllocator::_alloc(void *ud, void *ptr, size_t osize, size_t nsize)
+{
+    return static_cast<LuaAllocator *>(ud)->_realloc(ptr, osize, nsize);
+}
+
+
+
+/* ===[ Strict ]=== */
+LuaAllocator::Strict::Strict(LuaAllocator &allocator)
+:   _allocator{allocator}
+,   _was{allocator._strict}
+{
+    _allocator._strict = true;
+}
+
+
+LuaAllocator::Strict::~Strict()
+{
+    _allocator._strict = _was;
+}
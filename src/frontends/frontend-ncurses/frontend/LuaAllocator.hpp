@@ -0,0 +1,111 @@
+/* Copyright (C) 2023 Trevor Last
+ * See LICENSE file for copyright and license details.
+ */
+
+#ifndef FRONTENDNCURSES_LUAALLOCATOR_HPP
+#define FRONTENDNCURSES_LUAALLOCATOR_HPP
+
+#include <lua.hpp>
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+
+/**
+ * Allocator for one Lua state, with a memory limit.
+ *
+ * Blocks of up to MAX_POOLED bytes are rounded up to a multiple of GRANULE
+ * and kept on a free list per size, carved out of larger chunks, so the
+ * small tables and strings handlers churn through are reused cheaply rather
+ * than fragmenting the heap. Chunks are only freed with the allocator.
+ * Larger blocks go to malloc.
+ *
+ * Once the state's live blocks would pass the limit, allocating fails, so
+ * Lua collects garbage and then raises a memory error instead. The limit is
+ * only strict while Lua code runs, under a Strict guard: the frontend's own
+ * calls into the API, outside any protected call, get HOST_HEADROOM bytes
+ * more, as a memory error there would abort the process.
+ *
+ * LuaJIT states always use LuaJIT's own allocator, without the limit.
+ */
+class LuaAllocator
+{
+public:
+    struct Stats
+    {
+        size_t live;
+        size_t peak;
+        /** 0 if there is none. */
+        size_t limit;
+    };
+
+    /** Whether states use this allocator in this build. */
+    static bool const ENABLED;
+    /** Bytes over the limit allowed outside of Lua code. */
+    static constexpr size_t HOST_HEADROOM = 1 << 20;
+
+    /** Applies the limit strictly while it lives, eg. around lua_resume. */
+    class Strict
+    {
+        LuaAllocator &_allocator;
+        bool const _was;
+
+    public:
+        explicit Strict(LuaAllocator &allocator);
+        Strict(Strict const &)=delete;
+        Strict &operator=(Strict const &)=delete;
+        ~Strict();
+    };
+
+private:
+    static constexpr size_t GRANULE = 16;
+    static constexpr size_t CLASSES = 16;
+    static constexpr size_t MAX_POOLED = GRANULE * CLASSES;
+    static constexpr size_t CHUNK_SIZE = 64 * 1024;
+
+    struct Block
+    {
+        Block *next;
+    };
+    std::array<Block *, CLASSES> _free{};
+    std::vector<void *> _chunks{};
+    /** Unused part of the newest chunk. */
+    char *_bump{nullptr};
+    char *_bump_end{nullptr};
+
+    size_t const _limit;
+    /** Whether Lua code is running; see Strict. */
+    bool _strict{false};
+    /** Total bytes ever allocated. */
+    std::uint64_t _allocated{0};
+    /** Only written on the state's thread; may be read from any. */
+    std::atomic<size_t> _live{0};
+    std::atomic<size_t> _peak{0};
+
+    static size_t _class(size_t size) {return (size - 1) / GRANULE;}
+    /** Bytes a block of SIZE takes up. */
+    static size_t _footprint(size_t size);
+    void *_pool_alloc(size_t cls);
+    void _free_block(void *ptr, size_t size);
+    void *_realloc(void *ptr, size_t osize, size_t nsize);
+    static void *_alloc(void *ud, void *ptr, size_t osize, size_t nsize);
+
+public:
+    /** LIMIT is in bytes; 0 for no limit. */
+    explicit LuaAllocator(size_t limit);
+    LuaAllocator(LuaAllocator const &)=delete;
+    LuaAllocator &operator=(LuaAllocator const &)=delete;
+    ~LuaAllocator();
+
+    /** Create a Lua state using this, which must outlive it. */
+    lua_State *new_state();
+
+    /** Bytes allocated so far. Only call on the state's thread. */
+    std::uint64_t allocated() const {return _allocated;}
+    Stats get_stats() const;
+};
+
+
+#endif
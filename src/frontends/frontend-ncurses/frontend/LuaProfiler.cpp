@@ -0,0 +1,258 @@
+/* Copyright (C) 2023 Trevor Last
+ * See LICENSE file for copyright and license details.
+ */
+
+#include "LuaProfiler.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+
+/** Commands and functions tracked before the rest are lumped together. */
+static constexpr size_t MAX_ENTRIES = 256;
+/** Entry that commands and functions past MAX_ENTRIES are counted under. */
+static char const *const OTHER = "*other*";
+
+
+/** Eg. "830ns", "12.4us", "3.1ms". */
+static std::string format_duration(std::chrono::nanoseconds time)
+{
+    auto const ns = static_cast<double>(time.count());
+    char buf[32];
+    if (ns < 1e3)
+        std::snprintf(buf, sizeof(buf), "%.0fns", ns);
+    else if (ns < 1e6)
+        std::snprintf(buf, sizeof(buf), "%.1fus", ns / 1e3);
+    else if (ns < 1e9)
+        std::snprintf(buf, sizeof(buf), "%.1fms", ns / 1e6);
+    else
+        std::snprintf(buf, sizeof(buf), "%.2fs", ns / 1e9);
+    return buf;
+}
+
+
+/** Get the entry for KEY, or OTHER's once MAP is full. */
+template<typename T>
+static T &entry(std::map<std::string, T> &map, std::string const &key)
+{
+    auto const it = map.find(key);
+    if (it != map.end())
+        return it->second;
+    if (map.size() >= MAX_ENTRIES)
+        return map[OTHER];
+    return map[key];
+}
+
+
+/** MAP's entries by COST, highest first, up to LIMIT of them. */
+template<typename T, typename Cost>
+static std::vector<std::pair<std::string, T>> busiest(
+    std::map<std::string, T> const &map, size_t limit, Cost cost)
+{
+    std::vector<std::pair<std::string, T>> entries(map.begin(), map.end());
+    std::stable_sort(
+        entries.begin(), entries.end(),
+        [&cost](auto const &a, auto const &b){
+            return cost(a.second) > cost(b.second);
+        });
+    if (limit && entries.size() > limit)
+        entries.resize(limit);
+    return entries;
+}
+
+
+
+/* ===[ LatencyHistogram ]=== */
+void LatencyHistogram::record(std::chrono::nanoseconds time)
+{
+    auto const ns = time.count() < 0? 0 : time.count();
+    ++_counts[_bucket(static_cast<std::uint64_t>(ns))];
+    ++_count;
+    _total += time;
+    _max = std::max(_max, time);
+}
+
+
+void LatencyHistogram::merge(LatencyHistogram const &other)
+{
+    for (size_t i = 0; i < _counts.size(); ++i)
+        _counts[i] += other._counts[i];
+    _count += other._count;
+    _total += other._total;
+    _max = std::max(_max, other._max);
+}
+
+
+std::chrono::nanoseconds LatencyHistogram::percentile(double p) const
+{
+    if (_count == 0)
+        return std::chrono::nanoseconds{0};
+    auto const target = std::max<std::uint64_t>(
+        1, static_cast<std::uint64_t>(std::ceil(p / 100.0 * _count)));
+    std::uint64_t seen = 0;
+    for (size_t i = 0; i < _counts.size(); ++i)
+    {
+        seen += _counts[i];
+        if (seen >= target)
+        {
+            auto const upper = static_cast<std::int64_t>(_upper(i));
+            return std::min(std::chrono::nanoseconds{upper}, _max);
+        }
+    }
+    return _max;
+}
+
+
+size_t LatencyHistogram::_bucket(std::uint64_t ns)
+{
+    if (ns < SUB_BUCKETS)
+        return ns;
+    unsigned msb = 0;
+    while (ns >> (msb + 1))
+        ++msb;
+    auto const shift = msb - SUB_BITS;
+    return ((shift + 1) << SUB_BITS) + ((ns >> shift) - SUB_BUCKETS);
+}
+
+
+std::uint64_t LatencyHistogram::_upper(size_t bucket)
+{
+    if (bucket < SUB_BUCKETS)
+        return bucket;
+    auto const shift = (bucket >> SUB_BITS) - 1;
+    auto const sub = bucket & (SUB_BUCKETS - 1);
+    return ((sub + SUB_BUCKETS) << shift) + ((std::uint64_t{1} << shift) - 1);
+}
+
+
+
+/* ===[ LuaProfiler::Profile ]=== */
+void LuaProfiler::Profile::merge(Profile const &other)
+{
+    for (auto const &kv : other.commands)
+    {
+        auto &command = entry(commands, kv.first);
+        command.calls += kv.second.calls;
+        command.messages += kv.second.messages;
+        command.allocated += kv.second.allocated;
+        command.latency.merge(kv.second.latency);
+    }
+    for (auto const &kv : other.functions)
+    {
+        auto &function = entry(functions, kv.first);
+        function.samples += kv.second.samples;
+        function.time += kv.second.time;
+    }
+    gc_steps.merge(other.gc_steps);
+    gc_cycles += other.gc_cycles;
+}
+
+
+std::vector<std::string> LuaProfiler::Profile::report(size_t limit) const
+{
+    std::vector<std::string> lines{};
+    auto const by_time = [](Command const &c){return c.latency.total();};
+    for (auto const &kv : busiest(commands, limit, by_time))
+    {
+        auto const &c = kv.second;
+        auto line = kv.first + ": " + std::to_string(c.calls) + " calls ("
+            + std::to_string(c.messages) + " messages), p50 "
+            + format_duration(c.latency.percentile(50)) + ", p99 "
+            + format_duration(c.latency.percentile(99)) + ", max "
+            + format_duration(c.latency.max()) + ", total "
+            + format_duration(c.latency.total());
+        if (LuaAllocator::ENABLED)
+            line += ", " + std::to_string(c.allocated) + " bytes allocated";
+        lines.push_back(std::move(line));
+    }
+
+    auto const by_share = [](Function const &f){return f.time;};
+    for (auto const &kv : busiest(functions, limit, by_share))
+    {
+        lines.push_back(
+            kv.first + ": " + std::to_string(kv.second.samples)
+            + " samples, " + format_duration(kv.second.time));
+    }
+
+    if (gc_steps.count())
+    {
+        lines.push_back(
+            "idle GC: " + std::to_string(gc_steps.count()) + " steps, "
+            + std::to_string(gc_cycles) + " cycles, pause p50 "
+            + format_duration(gc_steps.percentile(50)) + ", p99 "
+            + format_duration(gc_steps.percentile(99)) + ", max "
+            + format_duration(gc_steps.max()));
+    }
+    return lines;
+}
+
+
+
+/* ===[ LuaProfiler ]=== */
+LuaProfiler::LuaProfiler(LuaAllocator const &allocator)
+:   _allocator{allocator}
+{
+}
+
+
+LuaProfiler::Mark LuaProfiler::start()
+{
+    _last_sample = std::chrono::steady_clock::now();
+    return {_last_sample, _allocator.allocated()};
+}
+
+
+void LuaProfiler::record(
+    std::string const &command, size_t messages, Mark mark)
+{
+    auto const time = std::chrono::steady_clock::now() - mark.time;
+    std::lock_guard<std::mutex> lock{_mutex};
+    auto &c = entry(_profile.commands, command);
+    ++c.calls;
+    c.messages += messages;
+    c.allocated += _allocator.allocated() - mark.allocated;
+    c.latency.record(time);
+}
+
+
+void LuaProfiler::record_gc(std::chrono::nanoseconds time, bool finished)
+{
+    std::lock_guard<std::mutex> lock{_mutex};
+    _profile.gc_steps.record(time);
+    _profile.gc_cycles += finished;
+}
+
+
+void LuaProfiler::sample(lua_State *L, lua_Debug *ar)
+{
+    if (!lua_getinfo(L, "Sn", ar))
+        return;
+
+    std::string name = std::string{ar->short_src} + ":"
+        + std::to_string(ar->linedefined);
+    if (ar->name)
+        name += std::string{" ("} + ar->name + ")";
+
+    auto const now = std::chrono::steady_clock::now();
+    std::lock_guard<std::mutex> lock{_mutex};
+    auto &function = entry(_profile.functions, name);
+    ++function.samples;
+    function.time += now - _last_sample;
+    _last_sample = now;
+}
+
+
+LuaProfiler::Profile LuaProfiler::snapshot()
+{
+    std::lock_guard<std::mutex> lock{_mutex};
+    return _profile;
+}
+
+
+void LuaProfiler::reset()
+{
+    std::lock_guard<std::mutex> lock{_mutex};
+    _profile = Profile{};
+}
+
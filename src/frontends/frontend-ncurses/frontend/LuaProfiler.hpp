@@ -0,0 +1,139 @@
+/* Copyright (C) 2023 Trevor Last
+ * See LICENSE file for copyright and license details.
+ */
+
+#ifndef FRONTENDNCURSES_LUAPROFILER_HPP
+#define FRONTENDNCURSES_LUAPROFILER_HPP
+
+#include "LuaAllocator.hpp"
+
+#include <lua.hpp>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+
+/**
+ * Histogram of durations in log-linear buckets, HDR-style: each power of two
+ * nanoseconds is split into 8 buckets, so values are kept to within 12.5%.
+ */
+class LatencyHistogram
+{
+    static constexpr unsigned SUB_BITS = 3;
+    static constexpr size_t SUB_BUCKETS = 1 << SUB_BITS;
+
+    std::array<std::uint32_t, 64 * SUB_BUCKETS> _counts{};
+    std::uint64_t _count{0};
+    std::chrono::nanoseconds _total{0};
+    std::chrono::nanoseconds _max{0};
+
+    static size_t _bucket(std::uint64_t ns);
+    /** Largest value that falls in BUCKET. */
+    static std::uint64_t _upper(size_t bucket);
+
+public:
+    void record(std::chrono::nanoseconds time);
+    void merge(LatencyHistogram const &other);
+
+    /** Value below which P percent (0-100) of the recorded values fall. */
+    std::chrono::nanoseconds percentile(double p) const;
+
+    std::uint64_t count() const {return _count;}
+    std::chrono::nanoseconds total() const {return _total;}
+    std::chrono::nanoseconds max() const {return _max;}
+};
+
+
+/**
+ * Per-command handler profile of one Lua state.
+ *
+ * Every dispatch is timed, and the bytes the state allocates meanwhile are
+ * counted by its LuaAllocator (except under LuaJIT). Optionally, the
+ * state's LuaWatchdog samples the running function every so many
+ * instructions, and it is charged the time since the previous sample.
+ * LuaJIT doesn't run hooks inside compiled traces, so samples there only
+ * cover interpreted code.
+ *
+ * Recording happens on the state's thread; `snapshot` and `set_sampling` may
+ * be called from any thread.
+ */
+class LuaProfiler
+{
+public:
+    struct Command
+    {
+        /** Dispatches: one per message, or one per batch handler call. */
+        std::uint64_t calls{0};
+        std::uint64_t messages{0};
+        /** Bytes allocated by Lua while dispatching. */
+        std::uint64_t allocated{0};
+        LatencyHistogram latency{};
+    };
+    struct Function
+    {
+        std::uint64_t samples{0};
+        std::chrono::nanoseconds time{0};
+    };
+    struct Profile
+    {
+        std::map<std::string, Command> commands{};
+        /** By "source:line (name)" of the function's definition. */
+        std::map<std::string, Function> functions{};
+        /** Garbage collection steps run in idle time. */
+        LatencyHistogram gc_steps{};
+        /** Collection cycles finished by those steps. */
+        std::uint64_t gc_cycles{0};
+
+        void merge(Profile const &other);
+        /**
+         * Lines describing the profile, busiest commands and functions
+         * first. LIMIT caps each list, if non-zero.
+         */
+        std::vector<std::string> report(size_t limit=0) const;
+    };
+
+    /** Where the time and allocations of a dispatch started from. */
+    struct Mark
+    {
+        std::chrono::steady_clock::time_point time;
+        std::uint64_t allocated;
+    };
+
+private:
+    std::mutex _mutex{};
+    Profile _profile{};
+
+    LuaAllocator const &_allocator;
+    std::atomic<int> _sample_interval{0};
+    std::chrono::steady_clock::time_point _last_sample{};
+
+public:
+    /** Profile a state using ALLOCATOR. */
+    explicit LuaProfiler(LuaAllocator const &allocator);
+
+    /** Start timing a dispatch. */
+    Mark start();
+    /** Record a dispatch of MESSAGES messages with COMMAND, from MARK. */
+    void record(std::string const &command, size_t messages, Mark mark);
+    /** Charge the function running in L, from a count hook. */
+    void sample(lua_State *L, lua_Debug *ar);
+
+    /** Record a GC step that took TIME, and whether it ended a cycle. */
+    void record_gc(std::chrono::nanoseconds time, bool finished);
+
+    /** Sample every INTERVAL Lua instructions, or stop sampling if 0. */
+    void set_sampling(int interval) {_sample_interval = interval;}
+    int get_sampling() const {return _sample_interval;}
+
+    Profile snapshot();
+    void reset();
+};
+
+
+#endif
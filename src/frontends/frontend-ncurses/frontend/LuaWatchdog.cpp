@@ -0,0 +1,148 @@
+/* Copyright (C) 2023 Trevor Last
+ * See LICENSE file for copyright and license details.
+ */
+
+#include "LuaWatchdog.hpp"
+
+
+/** Registry field holding the state's LuaWatchdog, as light userdata. */
+static char const *const WATCHDOG_KEY = "IRCC.watchdog";
+
+
+
+LuaWatchdog::LuaWatchdog(LuaProfiler &profiler, Budget budget)
+:   _profiler{profiler}
+,   _default{budget}
+{
+}
+
+
+void LuaWatchdog::attach(lua_State *L)
+{
+    lua_pushlightuserdata(L, this);
+    lua_setfield(L, LUA_REGISTRYINDEX, WATCHDOG_KEY);
+}
+
+
+void LuaWatchdog::start(lua_State *L, std::string const &name)
+{
+    Budget budget;
+    {
+        std::lock_guard<std::mutex> lock{_mutex};
+        auto const it = _budgets.find(name.substr(0, name.find('#')));
+        budget = (it != _budgets.cend())? it->second : _default;
+    }
+
+    auto const sampling = _profiler.get_sampling();
+    int interval = (budget.count() > 0)? CHECK_INTERVAL : 0;
+    if (sampling > 0 && (interval == 0 || sampling < interval))
+        interval = sampling;
+    // Each coroutine has its own hook.
+    if (interval != _hooked_interval)
+        _unsampled = 0;
+    _hooked_interval = interval;
+    if (interval == 0 && lua_gethook(L))
+        lua_sethook(L, nullptr, 0, 0);
+    else if (interval > 0
+        && (lua_gethook(L) != _hook || lua_gethookcount(L) != interval))
+        lua_sethook(L, _hook, LUA_MASKCOUNT, interval);
+
+    _budget = budget;
+    _armed = budget.count() > 0;
+    _tripped = false;
+    _deadline = std::chrono::steady_clock::now() + budget;
+}
+
+
+LuaWatchdog::Outcome LuaWatchdog::stop(std::string const &name)
+{
+    _armed = false;
+    if (!_tripped)
+    {
+        if (!_strikes.empty())
+            _strikes.erase(name);
+        return Outcome::FINISHED;
+    }
+    _tripped = false;
+    if (++_strikes[name] < QUARANTINE_STRIKES)
+        return Outcome::ABORTED;
+
+    _strikes.erase(name);
+    std::lock_guard<std::mutex> lock{_mutex};
+    _quarantined.insert(name);
+    return Outcome::QUARANTINED;
+}
+
+
+bool LuaWatchdog::quarantined(std::string const &name) const
+{
+    std::lock_guard<std::mutex> lock{_mutex};
+    return _quarantined.count(name) != 0;
+}
+
+
+void LuaWatchdog::pardon(std::string const &name)
+{
+    _strikes.erase(name);
+    std::lock_guard<std::mutex> lock{_mutex};
+    _quarantined.erase(name);
+}
+
+
+std::set<std::string> LuaWatchdog::get_quarantined() const
+{
+    std::lock_guard<std::mutex> lock{_mutex};
+    return _quarantined;
+}
+
+
+void LuaWatchdog::set_budget(std::string const &name, Budget budget)
+{
+    std::lock_guard<std::mutex> lock{_mutex};
+    if (name.empty())
+        _default = budget;
+    else
+        _budgets[name] = budget;
+}
+
+
+std::map<std::string, LuaWatchdog::Budget> LuaWatchdog::get_budgets() const
+{
+    std::lock_guard<std::mutex> lock{_mutex};
+    auto budgets = _budgets;
+    budgets[""] = _default;
+    return budgets;
+}
+
+
+
+/* ==[ Private ]== */
+void LuaWatchdog::_hook(lua_State *L, lua_Debug *ar)
+{
+    lua_getfield(L, LUA_REGISTRYINDEX, WATCHDOG_KEY);
+    auto const self = static_cast<LuaWatchdog *>(lua_touserdata(L, -1));
+    lua_pop(L, 1);
+    if (!self)
+        return;
+
+    auto const sampling = self->_profiler.get_sampling();
+    if (sampling > 0)
+    {
+        self->_unsampled += self->_hooked_interval;
+        if (self->_unsampled >= sampling)
+        {
+            self->_unsampled = 0;
+            self->_profiler.sample(L, ar);
+        }
+    }
+
+    if (!self->_armed)
+        return;
+    if (!self->_tripped
+        && std::chrono::steady_clock::now() < self->_deadline)
+        return;
+    self->_tripped = true;
+    luaL_error(
+        L, "handler ran over its %dms budget",
+        static_cast<int>(self->_budget.count()));
+}
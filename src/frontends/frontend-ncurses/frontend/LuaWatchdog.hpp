@@ -0,0 +1,113 @@
+/* Copyright (C) 2023 Trevor Last
+ * See LICENSE file for copyright and license details.
+ */
+
+#ifndef FRONTENDNCURSES_LUAWATCHDOG_HPP
+#define FRONTENDNCURSES_LUAWATCHDOG_HPP
+
+#include "LuaProfiler.hpp"
+
+#include <lua.hpp>
+
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <unordered_map>
+
+
+/**
+ * Bounds how long a Lua handler call may run, so a runaway handler can't
+ * freeze the client.
+ *
+ * A count hook checks the time every CHECK_INTERVAL Lua instructions. Once
+ * a call is over its command's budget, every check raises an error until
+ * the call returns, so `pcall` in the handler can't swallow it. A command
+ * whose handlers are aborted QUARANTINE_STRIKES times in a row is
+ * quarantined: its Lua handlers are skipped until they are assigned again,
+ * eg. by reloading their script. A name like "@timer#12" has the budget of
+ * the name before the '#', but its own strikes and quarantine.
+ *
+ * Time spent inside C functions, and under LuaJIT in compiled code, isn't
+ * checked, so the bound is approximate there.
+ *
+ * As a state has only one hook, it also takes the profiler's samples.
+ * Budgets may be set and read from any thread; the rest must be called on
+ * the state's thread.
+ */
+class LuaWatchdog
+{
+public:
+    /** How long a call may run; 0 for no limit. */
+    using Budget = std::chrono::milliseconds;
+
+    /** Lua instructions between checks. */
+    static constexpr int CHECK_INTERVAL = 1000;
+    /** Aborted calls in a row before a command is quarantined. */
+    static constexpr unsigned QUARANTINE_STRIKES = 3;
+    /** Budget for commands without their own, unless overridden. */
+    static constexpr Budget DEFAULT_BUDGET{250};
+
+    enum class Outcome
+    {
+        /** Within budget. */
+        FINISHED,
+        /** Over budget. */
+        ABORTED,
+        /** Over budget, and the command is quarantined now. */
+        QUARANTINED,
+    };
+
+private:
+    LuaProfiler &_profiler;
+
+    /** Guards the members below, up to _quarantined. */
+    mutable std::mutex _mutex{};
+    Budget _default;
+    /** By handler name, ie. lowercase command. */
+    std::map<std::string, Budget> _budgets{};
+    std::set<std::string> _quarantined{};
+
+    /** Aborted calls in a row, by handler name. */
+    std::unordered_map<std::string, unsigned> _strikes{};
+    int _hooked_interval{0};
+    /** Instructions run since the profiler's last sample. */
+    int _unsampled{0};
+    /** The running call's budget and deadline, if armed. */
+    Budget _budget{0};
+    std::chrono::steady_clock::time_point _deadline{};
+    bool _armed{false};
+    /** Whether the running call is over its budget. */
+    bool _tripped{false};
+
+    static void _hook(lua_State *L, lua_Debug *ar);
+
+public:
+    /** Watch a state profiled by PROFILER, with a default BUDGET. */
+    explicit LuaWatchdog(LuaProfiler &profiler, Budget budget=DEFAULT_BUDGET);
+
+    /** Watch L, which must not outlive this. */
+    void attach(lua_State *L);
+
+    /**
+     * Start timing a call to NAME's handler in L, which may be a coroutine.
+     * Also applies the profiler's sampling interval.
+     */
+    void start(lua_State *L, std::string const &name);
+    /** End the call to NAME's handler. */
+    Outcome stop(std::string const &name);
+
+    bool quarantined(std::string const &name) const;
+    /** Lift NAME's quarantine, eg. when its handler is replaced. */
+    void pardon(std::string const &name);
+    std::set<std::string> get_quarantined() const;
+
+    /** Set NAME's budget, or the default if NAME is empty. */
+    void set_budget(std::string const &name, Budget budget);
+    /** Commands with their own budget, and the default under "". */
+    std::map<std::string, Budget> get_budgets() const;
+};
+
+
+#endif
@@ -0,0 +1,386 @@
+/* Copyright (C) 2023 Trevor Last
+ * See LICENSE file for copyright and license details.
+ */
+
+#include "LuaWorkers.hpp"
+
+#include <util/debug.hpp>
+#include <util/strings.hpp>
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <functional>
+#include <shared_mutex>
+#include <string_view>
+#include <system_error>
+
+
+LuaWorkers::LuaWorkers(Backend &backend, size_t count, int notify_fd)
+:   _backend{backend}
+,   _notify_fd{notify_fd}
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        auto w = std::make_unique<Worker>();
+        w->handler.reset(new FrontendMessageHandler{});
+        w->deferred.mutex = &_backend.get_mutex();
+        w->handler->defer(w->deferred);
+        _workers.push_back(std::move(w));
+    }
+    for (auto &w : _workers)
+        w->thread = std::thread{&LuaWorkers::_run, this, std::ref(*w)};
+}
+
+
+LuaWorkers::~LuaWorkers()
+{
+    stop();
+}
+
+
+void LuaWorkers::stop()
+{
+    for (auto &w : _workers)
+    {
+        {
+            std::lock_guard<std::mutex> lock{w->mutex};
+            w->stop = true;
+        }
+        w->wake.notify_one();
+    }
+    for (auto &w : _workers)
+        if (w->thread.joinable())
+            w->thread.join();
+}
+
+
+void LuaWorkers::dispatch(std::vector<Message> const &messages)
+{
+    std::vector<std::optional<size_t>> routes{};
+    routes.reserve(messages.size());
+    for (auto const &msg : messages)
+        routes.push_back(_route(msg));
+
+    // Runs of channel messages go out together; the workers must finish
+    // everything before a run of other messages is started, and that run
+    // before the next channel messages are.
+    for (size_t begin = 0; begin < messages.size(); )
+    {
+        bool const serial = !routes[begin];
+        auto end = begin + 1;
+        while (end < messages.size() && !routes[end] == serial)
+            ++end;
+        if (serial != _serial)
+        {
+            _drain();
+            _serial = serial;
+        }
+        _send(&messages[begin], &messages[0] + end, &routes[begin]);
+        begin = end;
+    }
+}
+
+
+void LuaWorkers::reload(std::string const &path)
+{
+    for (auto &w : _workers)
+    {
+        {
+            std::lock_guard<std::mutex> lock{w->mutex};
+            w->reloads.push_back(path);
+        }
+        w->wake.notify_one();
+    }
+}
+
+
+void LuaWorkers::apply()
+{
+    std::uint64_t count;
+    if (read(_notify_fd, &count, sizeof(count)) == -1 && errno != EAGAIN)
+        throw std::system_error{errno, std::generic_category(), "read()"};
+
+    std::vector<BackendCommand> commands{};
+    {
+        std::lock_guard<std::mutex> lock{_outbox_mutex};
+        commands.swap(_outbox);
+    }
+    for (auto const &command : commands)
+    {
+        try {
+            command();
+        }
+        catch (std::exception const &e) {
+            debugstream << "!!Error applying handler changes: " << e.what()
+                << std::endl;
+        }
+    }
+}
+
+
+void LuaWorkers::run_timers()
+{
+    auto const now = std::chrono::steady_clock::now();
+    for (auto &w : _workers)
+    {
+        if (w->handler->next_timer() > now)
+            continue;
+        {
+            std::lock_guard<std::mutex> lock{w->mutex};
+            w->timers = true;
+        }
+        w->wake.notify_one();
+    }
+}
+
+
+std::chrono::steady_clock::time_point LuaWorkers::next_timer()
+{
+    auto next = std::chrono::steady_clock::time_point::max();
+    for (auto &w : _workers)
+    {
+        std::lock_guard<std::mutex> lock{w->mutex};
+        if (!w->timers)
+            next = std::min(next, w->handler->next_timer());
+    }
+    return next;
+}
+
+
+void LuaWorkers::drop_waiters()
+{
+    for (auto &w : _workers)
+    {
+        {
+            std::lock_guard<std::mutex> lock{w->mutex};
+            w->drop_waiters = true;
+        }
+        w->wake.notify_one();
+    }
+}
+
+
+FrontendMessageHandler::Stats LuaWorkers::get_stats()
+{
+    FrontendMessageHandler::Stats total{};
+    for (auto &w : _workers)
+    {
+        std::lock_guard<std::mutex> lock{w->mutex};
+        total.messages += w->stats.messages;
+        total.unhandled += w->stats.unhandled;
+        total.native += w->stats.native;
+        total.calls += w->stats.calls;
+        total.aborted += w->stats.aborted;
+        total.waiting += w->stats.waiting;
+        total.timer_calls += w->stats.timer_calls;
+        total.timers += w->stats.timers;
+        total.time += w->stats.time;
+        total.worst = std::max(total.worst, w->stats.worst);
+    }
+    return total;
+}
+
+
+LuaAllocator::Stats LuaWorkers::get_memory()
+{
+    LuaAllocator::Stats total{};
+    for (auto &w : _workers)
+    {
+        auto const memory = w->handler->get_memory();
+        total.live += memory.live;
+        total.peak += memory.peak;
+        total.limit += memory.limit;
+    }
+    return total;
+}
+
+
+std::vector<LuaProfiler *> LuaWorkers::get_profilers()
+{
+    std::vector<LuaProfiler *> profilers{};
+    for (auto &w : _workers)
+        profilers.push_back(&w->handler->get_profiler());
+    return profilers;
+}
+
+
+std::vector<LuaWatchdog *> LuaWorkers::get_watchdogs()
+{
+    std::vector<LuaWatchdog *> watchdogs{};
+    for (auto &w : _workers)
+        watchdogs.push_back(&w->handler->get_watchdog());
+    return watchdogs;
+}
+
+
+
+/* ==[ Private ]== */
+void LuaWorkers::_run(Worker &w)
+{
+    std::vector<Message> messages{};
+    std::vector<Message> replies{};
+    std::vector<std::string> reloads{};
+    bool timers = false;
+    bool drop_waiters = false;
+    bool stop = false;
+    auto const ready = [&w](){
+        return w.stop || !w.inbox.empty() || !w.replies.empty()
+            || !w.reloads.empty() || w.timers || w.drop_waiters;
+    };
+    bool garbage = true;
+    for (;;)
+    {
+        {
+            std::unique_lock<std::mutex> lock{w.mutex};
+            // Collect garbage once no messages have come for a while.
+            if (!garbage)
+                w.wake.wait(lock, ready);
+            else if (!w.wake.wait_for(lock, IDLE_DELAY, ready))
+            {
+                lock.unlock();
+                garbage = w.handler->collect_garbage(
+                    FrontendMessageHandler::GC_BUDGET);
+                continue;
+            }
+            stop = w.stop;
+            messages.swap(w.inbox);
+            replies.swap(w.replies);
+            reloads.swap(w.reloads);
+            timers = w.timers;
+            drop_waiters = w.drop_waiters;
+            w.drop_waiters = false;
+            w.busy = true;
+        }
+        garbage = true;
+
+        for (auto const &path : reloads)
+        {
+            auto const result = w.handler->reload(path);
+            if (result.empty() || &w != _workers.front().get())
+                continue;
+            w.deferred.commands.emplace_back(
+                [this, result](){
+                    debugstream << result << std::endl;
+                    _backend.get_active_channel().push_message(result);
+                });
+        }
+        reloads.clear();
+
+        if (!replies.empty())
+            w.handler->wake(replies);
+        replies.clear();
+        if (timers)
+        {
+            w.handler->run_timers(_backend);
+            // Cleared only now, so that 'next_timer' doesn't see the ones
+            // that were due meanwhile.
+            std::lock_guard<std::mutex> lock{w.mutex};
+            w.timers = false;
+        }
+        if (!messages.empty())
+            w.handler->execute(_backend, messages);
+        messages.clear();
+        if (drop_waiters)
+            w.handler->drop_waiters();
+        _flush(w);
+
+        // Only after handling what was queued, so that no PONG is lost.
+        if (stop)
+            return;
+    }
+}
+
+
+void LuaWorkers::_flush(Worker &w)
+{
+    {
+        std::lock_guard<std::mutex> lock{_outbox_mutex};
+        _outbox.insert(
+            _outbox.end(),
+            std::make_move_iterator(w.deferred.commands.begin()),
+            std::make_move_iterator(w.deferred.commands.end()));
+    }
+    w.deferred.commands.clear();
+    {
+        std::lock_guard<std::mutex> lock{w.mutex};
+        w.stats = w.handler->get_stats();
+        w.busy = false;
+    }
+    w.idle.notify_all();
+
+    // Can only fail if the count would overflow, which still wakes the main
+    // thread.
+    std::uint64_t const one = 1;
+    auto const written = write(_notify_fd, &one, sizeof(one));
+    (void)written;
+}
+
+
+std::optional<size_t> LuaWorkers::_route(Message const &msg) const
+{
+    // The first parameter that looks like a channel name, eg. the target of
+    // a PRIVMSG or the channel of a NAMES reply.
+    for (size_t i = 0; i < msg.params.size() && i < 3; ++i)
+    {
+        auto const &param = msg.params[i];
+        if (param.empty()
+            || std::string_view{"#&+!"}.find(param[0]) == std::string::npos
+            || param.find(' ') != std::string::npos)
+            continue;
+        auto const key = casefold(param, _backend.get_casemapping());
+        return std::hash<std::string>{}(key) % _workers.size();
+    }
+    return std::nullopt;
+}
+
+
+void LuaWorkers::_send(
+    Message const *first, Message const *last,
+    std::optional<size_t> const *routes)
+{
+    std::vector<std::vector<Message>> shards(_workers.size());
+    std::vector<std::vector<Message>> replies(_workers.size());
+    for (auto msg = first; msg != last; ++msg, ++routes)
+    {
+        auto const route = routes->value_or(0);
+        shards[route].push_back(*msg);
+        for (size_t i = 0; i < _workers.size(); ++i)
+            if (i != route && _workers[i]->handler->awaits(msg->command))
+                replies[i].push_back(*msg);
+    }
+
+    for (size_t i = 0; i < shards.size(); ++i)
+    {
+        if (shards[i].empty() && replies[i].empty())
+            continue;
+        auto &w = *_workers[i];
+        {
+            std::lock_guard<std::mutex> lock{w.mutex};
+            w.inbox.insert(
+                w.inbox.end(),
+                std::make_move_iterator(shards[i].begin()),
+                std::make_move_iterator(shards[i].end()));
+            w.replies.insert(
+                w.replies.end(),
+                std::make_move_iterator(replies[i].begin()),
+                std::make_move_iterator(replies[i].end()));
+        }
+        w.wake.notify_one();
+    }
+}
+
+
+void LuaWorkers::_drain()
+{
+    for (auto &w : _workers)
+    {
+        std::unique_lock<std::mutex> lock{w->mutex};
+        w->idle.wait(lock, [&w](){
+            return w->inbox.empty() && w->replies.empty() && !w->busy;});
+    }
+    std::unique_lock<std::shared_mutex> lock{_backend.get_mutex()};
+    apply();
+}
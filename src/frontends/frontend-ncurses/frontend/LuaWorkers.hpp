@@ -0,0 +1,158 @@
+/* Copyright (C) 2023 Trevor Last
+ * See LICENSE file for copyright and license details.
+ */
+
+#ifndef FRONTENDNCURSES_LUAWORKERS_HPP
+#define FRONTENDNCURSES_LUAWORKERS_HPP
+
+#include <Backend.hpp>
+#include <MessageHandler.hpp>
+#include <LuaDeferred.hpp>
+
+#include <irc/Message.hpp>
+
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+/**
+ * Runs message handlers on worker threads, each with its own Lua state.
+ *
+ * Messages about a channel always go to the same worker, so each channel's
+ * messages are handled in order, in parallel with other channels'. Other
+ * messages, eg. QUIT or NICK, can touch any channel, so they're a barrier:
+ * the messages before them are handled and their changes applied first, then
+ * they run on the first worker and are applied before the messages after
+ * them run.
+ * Handlers waiting in `Backend:await` are also woken by messages routed to
+ * other workers. Each worker runs its own state's timers, when told to by
+ * 'run_timers'.
+ * Scripts are loaded separately into every worker, so they don't share
+ * globals. Backend changes made by handlers are queued, and NOTIFY_FD (an
+ * eventfd) is written to when there are some to 'apply'. Workers collect
+ * their garbage themselves when they're idle.
+ */
+class LuaWorkers
+{
+    struct Worker
+    {
+        std::unique_ptr<FrontendMessageHandler> handler;
+        DeferredBackend deferred;
+        std::thread thread{};
+
+        /** Guards the members below. */
+        std::mutex mutex{};
+        std::condition_variable wake{};
+        std::vector<Message> inbox{};
+        /** Messages other workers handle, that handlers here wait for. */
+        std::vector<Message> replies{};
+        /** Scripts to re-run before the next messages. */
+        std::vector<std::string> reloads{};
+        /** Whether to run the handler's due timers. */
+        bool timers{false};
+        /** Whether to drop the handlers waiting for replies. */
+        bool drop_waiters{false};
+        /** Whether it's handling what it took, until it flushes. */
+        bool busy{false};
+        /** Notified when it's flushed. */
+        std::condition_variable idle{};
+        FrontendMessageHandler::Stats stats{};
+        bool stop{false};
+    };
+
+    /** How long a worker waits for messages before collecting garbage. */
+    static constexpr std::chrono::milliseconds IDLE_DELAY{10};
+
+    Backend &_backend;
+    int const _notify_fd;
+    std::vector<std::unique_ptr<Worker>> _workers{};
+
+    std::mutex _outbox_mutex{};
+    std::vector<BackendCommand> _outbox{};
+    /** Whether the last messages dispatched weren't about a channel. */
+    bool _serial{false};
+
+    /** Worker thread body. */
+    void _run(Worker &w);
+    /** Hand W's queued Backend changes to the main thread. */
+    void _flush(Worker &w);
+    /**
+     * Index of the worker that handles MSG, or nullopt if it isn't about a
+     * channel.
+     */
+    std::optional<size_t> _route(Message const &msg) const;
+    /**
+     * Hand the messages from FIRST to LAST to the workers ROUTES says, the
+     * first worker where it's nullopt.
+     */
+    void _send(
+        Message const *first, Message const *last,
+        std::optional<size_t> const *routes);
+    /**
+     * Wait for every worker to handle what it was handed, then apply the
+     * changes they queued.
+     */
+    void _drain();
+
+public:
+    /** Load the scripts into COUNT Lua states and start their threads. */
+    LuaWorkers(Backend &backend, size_t count, int notify_fd);
+    /** Stops the workers; changes they queued that weren't applied are lost. */
+    ~LuaWorkers();
+
+    /**
+     * Stop the workers once they've handled the messages handed to them.
+     * Call without holding the backend's mutex, then 'apply' the changes
+     * they queued.
+     */
+    void stop();
+
+    /**
+     * Hand MESSAGES to the workers. Waits for them at each barrier, so call
+     * without holding the backend's mutex.
+     */
+    void dispatch(std::vector<Message> const &messages);
+    /**
+     * Have every worker re-run the script at PATH, between messages. The
+     * first worker reports how long it took to the active channel.
+     */
+    void reload(std::string const &path);
+    /**
+     * Apply Backend changes queued by the workers. Call on the main thread,
+     * holding the backend's mutex.
+     */
+    void apply();
+
+    /** Have the workers whose timers are due run them. */
+    void run_timers();
+    /**
+     * When 'run_timers' should next be called, or time_point::max() for
+     * never. Workers already told to run their timers are left out, until
+     * they've run them and written to NOTIFY_FD.
+     */
+    std::chrono::steady_clock::time_point next_timer();
+
+    /**
+     * Have every worker drop its handlers waiting for replies, once it's
+     * handled the messages handed to it.
+     */
+    void drop_waiters();
+
+    /** Total handler stats over all workers. */
+    FrontendMessageHandler::Stats get_stats();
+    /** Total Lua memory use over all workers. */
+    LuaAllocator::Stats get_memory();
+    /** Every worker's profiler. */
+    std::vector<LuaProfiler *> get_profilers();
+    /** Every worker's watchdog. */
+    std::vector<LuaWatchdog *> get_watchdogs();
+};
+
+
+#endif
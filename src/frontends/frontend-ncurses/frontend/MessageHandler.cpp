@@ -6,73 +6,475 @@
 
 #include <util/debug.hpp>
 #include <util/strings.hpp>
+#include <LuaAwait.hpp>
 #include <LuaBackend.hpp>
+#include <LuaBytecode.hpp>
 #include <LuaChannel.hpp>
+#include <LuaDeferred.hpp>
 #include <LuaMessage.hpp>
+#include <LuaTimers.hpp>
 
+#include <algorithm>
 #include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <iterator>
+
+
+/** Registry field holding the table behind the `IRC` proxy. */
+static char const *const HANDLERS_KEY = "IRCC.handlers";
+
+/**
+ * Budget name timer functions share; not a command name, so no server
+ * command shares it.
+ */
+static char const *const TIMER_HANDLER = "@timer";
+
+/** Scripts run into every state, in order. */
+static char const *const SCRIPTS[] = {
+    "scripts/compat.lua",
+    "scripts/responses.lua",
+};
+
+
+/** Lua memory limit in bytes, from the environment. */
+static size_t memory_limit()
+{
+    if (auto const mb = std::getenv("IRCC_LUA_MEMORY_MB"))
+        return std::strtoull(mb, nullptr, 10) << 20;
+    return FrontendMessageHandler::DEFAULT_MEMORY_LIMIT;
+}
+
+
+/** Handler time budget, from the environment. */
+static LuaWatchdog::Budget time_budget()
+{
+    if (auto const ms = std::getenv("IRCC_LUA_BUDGET_MS"))
+        return LuaWatchdog::Budget{std::strtoll(ms, nullptr, 10)};
+    return LuaWatchdog::DEFAULT_BUDGET;
+}
+
+
+/** Command a handler is for, eg. "join" for "join_batch". */
+static std::string handler_command(std::string name)
+{
+    auto const suffix = name.rfind("_batch");
+    if (suffix != std::string::npos && suffix + 6 == name.size())
+        name.erase(suffix);
+    return name;
+}
+
+
+/**
+ * Handler name timer ID's function runs under, eg. "@timer#12": it has the
+ * budget of TIMER_HANDLER, but is quarantined on its own.
+ */
+static std::string timer_handler(std::uint64_t id)
+{
+    return std::string{TIMER_HANDLER} + "#" + std::to_string(id);
+}
+
+
+/** Whether NAME is a handler name from 'timer_handler'. */
+static bool is_timer_handler(std::string const &name)
+{
+    return name.rfind(std::string{TIMER_HANDLER} + "#", 0) == 0;
+}
 
 
 /** Replacement Lua `print` function. Outputs to `debugstream` instead. */
 static int debug_lua_print(lua_State *L)
 {
     int const n = lua_gettop(L);
-    debugstream << "print: ";
+    std::string line{"print: "};
     for (int i = 1; i <= n; ++i)
     {
-        auto const str = luaL_tolstring(L, i, nullptr);
+        line += luaL_tolstring(L, i, nullptr);
+        line += ' ';
         lua_pop(L, 1);
-        debugstream << str << ' ';
     }
-    debugstream << std::endl;
+    lua_debuglog(L, std::move(line));
     return 0;
 }
 
 
+/** Run a built-in handler, showing MSG instead if it fails. */
+static void run_native(Backend &b, NativeHandler fn, Message const &msg)
+{
+    try {
+        fn(b, msg);
+    }
+    catch (std::runtime_error const &e) {
+        debugstream << "!!Error in built-in '" << lowercase(msg.command)
+            << "' handler: " << e.what() << std::endl;
+        b.get_active_channel().push_message(msg);
+    }
+}
+
+
+/**
+ * IRC.__newindex: set a handler and drop the cached handler references. A
+ * new handler lifts its command's quarantine.
+ */
+static int irc__newindex(lua_State *L)
+{
+    auto const handler = static_cast<FrontendMessageHandler *>(
+        lua_touserdata(L, lua_upvalueindex(1)));
+    lua_getfield(L, LUA_REGISTRYINDEX, HANDLERS_KEY);
+    lua_pushvalue(L, 2);
+    lua_pushvalue(L, 3);
+    lua_settable(L, -3);
+    if (lua_type(L, 2) == LUA_TSTRING)
+    {
+        handler->get_watchdog().pardon(handler_command(lua_tostring(L, 2)));
+        handler->assigned(lua_tostring(L, 2));
+    }
+    handler->invalidate_handlers();
+    return 0;
+}
+
+
+/** Iterator for IRC.__pairs. */
+static int irc__next(lua_State *L)
+{
+    luaL_checktype(L, 1, LUA_TTABLE);
+    lua_settop(L, 2);
+    if (lua_next(L, 1))
+        return 2;
+    lua_pushnil(L);
+    return 1;
+}
+
+
+/** IRC.__pairs: iterate over the handlers behind the proxy. */
+static int irc__pairs(lua_State *L)
+{
+    lua_pushcfunction(L, irc__next);
+    lua_getfield(L, LUA_REGISTRYINDEX, HANDLERS_KEY);
+    lua_pushnil(L);
+    return 3;
+}
+
+
 
 FrontendMessageHandler::FrontendMessageHandler()
-:   _L_actual{luaL_newstate()}
+:   _allocator{memory_limit()}
+,   _watchdog{_profiler, time_budget()}
+,   _L_actual{_allocator.new_state()}
 ,   L{_L_actual.get()}
 {
     if (!L)
-        throw std::runtime_error{"luaL_newstate() failed"};
+        throw std::runtime_error{"lua_newstate() failed"};
+    _watchdog.attach(L);
     luaL_checkversion(L);
     luaL_openlibs(L);
 
+    // Incremental rather than generational, so garbage can be collected in
+    // small steps when idle; see collect_garbage.
+#if LUA_VERSION_NUM >= 504
+    lua_gc(L, LUA_GCINC, GC_PAUSE, 0, 0);
+#else
+    lua_gc(L, LUA_GCSETPAUSE, GC_PAUSE);
+#endif
+
+    _awaits = lua_newawaits(L);
+    _timers = lua_newtimers(L);
+    luaopen_timer(L);
     luaL_requiref(L, "Message", luaopen_message, 1);
     luaL_requiref(L, "Backend", luaopen_backend, 1);
     luaL_requiref(L, "Channel", luaopen_channel, 1);
     lua_pop(L, 3);
 
+    // IRC: an empty proxy, so every assignment reaches __newindex.
     lua_newtable(L);
+    lua_pushvalue(L, -1);
+    lua_setfield(L, LUA_REGISTRYINDEX, HANDLERS_KEY);
+    lua_newtable(L);
+    lua_createtable(L, 0, 3);
+    lua_pushvalue(L, -3);
+    lua_setfield(L, -2, "__index");
+    lua_pushlightuserdata(L, this);
+    lua_pushcclosure(L, irc__newindex, 1);
+    lua_setfield(L, -2, "__newindex");
+    lua_pushcfunction(L, irc__pairs);
+    lua_setfield(L, -2, "__pairs");
+    lua_setmetatable(L, -2);
     lua_setglobal(L, "IRC");
+    lua_pop(L, 1);
 
     lua_pushcfunction(L, debug_lua_print);
     lua_setglobal(L, "print");
 
-    _guard(luaL_dofile(L, "scripts/responses.lua"));
+    if (auto const dir = std::getenv("IRCC_BYTECODE_DIR"))
+        _bytecode_dir = dir;
+    auto const start = std::chrono::steady_clock::now();
+    size_t cached = 0;
+    for (auto const script : SCRIPTS)
+    {
+        bool hit;
+        _guard(lua_loadcached(L, script, _bytecode_dir, &hit));
+        _running = script;
+        _guard(_pcall(0, 0));
+        _running = nullptr;
+        cached += hit;
+    }
+    std::chrono::duration<double, std::milli> const took =
+        std::chrono::steady_clock::now() - start;
+    debugstream << "=== loaded scripts in " << took.count() << "ms ("
+        << cached << " of " << std::size(SCRIPTS) << " from bytecode cache)"
+        << std::endl;
 }
 
 
 void FrontendMessageHandler::execute(Backend &b, Message const &msg)
 {
-    auto const cmd = lowercase(msg.command);
+    auto const start = std::chrono::steady_clock::now();
+    _dispatch(b, &msg, &msg + 1);
+    ++_stats.messages;
+    std::chrono::nanoseconds const time =
+        std::chrono::steady_clock::now() - start;
+    _stats.time += time;
+    _stats.worst = std::max(_stats.worst, time);
+    _update_stats();
+    _garbage = true;
+}
+
+
+void FrontendMessageHandler::execute(
+    Backend &b, std::vector<Message> const &messages)
+{
+    auto const start = std::chrono::steady_clock::now();
+    auto const first = messages.data();
+    size_t i = 0;
+    while (i < messages.size())
+    {
+        auto j = i + 1;
+        while (j < messages.size() && messages[j].command == first[i].command)
+            ++j;
+        _dispatch(b, first + i, first + j);
+        i = j;
+    }
+    _stats.messages += messages.size();
+    std::chrono::nanoseconds const time =
+        std::chrono::steady_clock::now() - start;
+    _stats.time += time;
+    _stats.worst = std::max(_stats.worst, time);
+    _update_stats();
+    _garbage = true;
+}
+
+
+void FrontendMessageHandler::wake(std::vector<Message> const &messages)
+{
+    for (auto const &msg : messages)
+        _wake(msg);
+    _update_stats();
+    _garbage = true;
+}
+
+
+bool FrontendMessageHandler::awaits(std::string const &command) const
+{
+    return _awaits->awaits(command);
+}
+
+
+void FrontendMessageHandler::run_timers(Backend &b)
+{
+    auto const start = std::chrono::steady_clock::now();
     auto const pre = lua_gettop(L);
+    for (auto const &timer : _timers->take(start))
+    {
+        // An earlier one may have cancelled it, releasing its reference.
+        if (timer.period.count() != 0 && !_timers->pending(timer.id))
+            continue;
+        lua_rawgeti(L, LUA_REGISTRYINDEX, timer.ref);
+        if (timer.period.count() == 0)
+            luaL_unref(L, LUA_REGISTRYINDEX, timer.ref);
+
+        auto const mark = _profiler.start();
+        if (lua_type(L, -1) == LUA_TTHREAD)
+        {
+            auto const co = lua_tothread(L, -1);
+            // Either an await timed out, resuming it with nil, or a sleep
+            // ended.
+            auto const ref = _awaits->cancel(timer.id);
+            if (ref != LUA_NOREF)
+            {
+                luaL_unref(L, LUA_REGISTRYINDEX, ref);
+                lua_pushnil(co);
+            }
+            _resume(co, timer.handler, ref != LUA_NOREF? 1 : 0);
+            _profiler.record(timer.handler, 1, mark);
+        }
+        else
+        {
+            auto const handler = timer_handler(timer.id);
+            if (!_watchdog.quarantined(handler))
+            {
+                lua_pushbackend(L, b);
+                _call(handler, 1);
+                ++_stats.timer_calls;
+                _profiler.record(TIMER_HANDLER, 1, mark);
+            }
+            // Only the timer whose function keeps running over is stopped.
+            if (_watchdog.quarantined(handler))
+            {
+                luaL_unref(L, LUA_REGISTRYINDEX, _timers->cancel(timer.id));
+                _watchdog.pardon(handler);
+                lua_debuglog(
+                    L,
+                    "!!Cancelled timer " + std::to_string(timer.id)
+                    + " after " + std::to_string(
+                        LuaWatchdog::QUARANTINE_STRIKES)
+                    + " aborted calls in a row");
+            }
+        }
+        lua_settop(L, pre);
+    }
+    std::chrono::nanoseconds const time =
+        std::chrono::steady_clock::now() - start;
+    _stats.worst = std::max(_stats.worst, time);
+    _update_stats();
+    _garbage = true;
+}
 
-    lua_getglobal(L, "IRC");
-    lua_getfield(L, -1, cmd.c_str());
 
-    lua_pushbackend(L, b);
-    lua_pushmessage(L, msg);
+std::chrono::steady_clock::time_point FrontendMessageHandler::next_timer()
+    const
+{
+    return _timers->next();
+}
+
+
+void FrontendMessageHandler::drop_waiters()
+{
+    for (auto const &waiter : _awaits->take_all())
+    {
+        luaL_unref(L, LUA_REGISTRYINDEX, waiter.ref);
+        if (waiter.timer != 0)
+            luaL_unref(L, LUA_REGISTRYINDEX, _timers->cancel(waiter.timer));
+    }
+    _update_stats();
+    _garbage = true;
+}
+
+
+void FrontendMessageHandler::defer(DeferredBackend &d)
+{
+    lua_setdeferred(L, &d);
+}
+
+
+std::string FrontendMessageHandler::reload(std::string const &path)
+{
+    auto const script = std::find(std::begin(SCRIPTS), std::end(SCRIPTS), path);
+    if (script == std::end(SCRIPTS))
+        return {};
+
+    // The whole chunk compiles before any of it runs, so a syntax error
+    // leaves the old handlers alone. Running it swaps handlers in through
+    // IRC.__newindex; globals it doesn't assign keep their values.
+    auto const start = std::chrono::steady_clock::now();
+    auto const pre = lua_gettop(L);
+    std::string result{};
     try {
-        _guard(lua_pcall(L, 2, 0, 0));
+        _guard(lua_loadcached(L, *script, _bytecode_dir));
+        _assigned.clear();
+        _running = *script;
+        auto const status = _pcall(0, 0);
+        _running = nullptr;
+        _guard(status);
+        std::chrono::duration<double, std::milli> const took =
+            std::chrono::steady_clock::now() - start;
+        char ms[32];
+        std::snprintf(ms, sizeof(ms), "%.2fms", took.count());
+        result = "=== reloaded " + path + " in " + ms;
+
+        // Handlers the script no longer defines go, as on a fresh start.
+        // Only once it ran to the end: an error may have cut it short.
+        std::string removed{};
+        lua_getfield(L, LUA_REGISTRYINDEX, HANDLERS_KEY);
+        for (auto it = _owners.begin(); it != _owners.end(); )
+        {
+            if (it->second != *script || _assigned.count(it->first))
+            {
+                ++it;
+                continue;
+            }
+            lua_pushnil(L);
+            lua_setfield(L, -2, it->first.c_str());
+            removed += (removed.empty()? "" : ", ") + it->first;
+            it = _owners.erase(it);
+        }
+        if (!removed.empty())
+        {
+            invalidate_handlers();
+            result += " (removed " + removed + ")";
+        }
     }
     catch (std::runtime_error const &e) {
-        debugstream << "!!Error in '" << cmd << "' handler: " << e.what()
-            << std::endl;
-        b.get_active_channel().push_message(msg);
+        _running = nullptr;
+        result = "=== failed to reload " + path + ": " + e.what();
     }
-    lua_pop(L, lua_gettop(L) - pre);
+    _assigned.clear();
+    lua_settop(L, pre);
+    _garbage = true;
+    return result;
+}
+
+
+std::vector<std::string> FrontendMessageHandler::scripts()
+{
+    return {std::begin(SCRIPTS), std::end(SCRIPTS)};
+}
+
+
+void FrontendMessageHandler::assigned(std::string const &name)
+{
+    if (!_running)
+        return;
+    _owners[name] = _running;
+    _assigned.insert(name);
+}
+
+
+bool FrontendMessageHandler::collect_garbage(std::chrono::microseconds budget)
+{
+    if (!_garbage)
+        return false;
+    auto const start = std::chrono::steady_clock::now();
+    for (;;)
+    {
+        auto const step = std::chrono::steady_clock::now();
+        bool const finished = lua_gc(L, LUA_GCSTEP, GC_STEP_KB);
+        auto const end = std::chrono::steady_clock::now();
+        _profiler.record_gc(end - step, finished);
+        if (finished)
+        {
+            _garbage = false;
+            return false;
+        }
+        if (end - start >= budget)
+            return true;
+    }
+}
+
+
+void FrontendMessageHandler::invalidate_handlers()
+{
+    for (auto &handlers : _numeric_handlers)
+    {
+        luaL_unref(L, LUA_REGISTRYINDEX, handlers.single);
+        luaL_unref(L, LUA_REGISTRYINDEX, handlers.batch);
+        handlers = Handlers{};
+    }
+    for (auto const &kv : _named_handlers)
+    {
+        luaL_unref(L, LUA_REGISTRYINDEX, kv.second.single);
+        luaL_unref(L, LUA_REGISTRYINDEX, kv.second.batch);
+    }
+    _named_handlers.clear();
 }
 
 
@@ -87,6 +489,310 @@ void FrontendMessageHandler::_guard(int status) const
 }
 
 
+int FrontendMessageHandler::_pcall(int nargs, int nresults)
+{
+    LuaAllocator::Strict const strict{_allocator};
+    return lua_pcall(L, nargs, nresults, 0);
+}
+
+
+void FrontendMessageHandler::_dispatch(
+    Backend &b, Message const *first, Message const *last)
+{
+    auto const pre = lua_gettop(L);
+
+    auto const batch = _handler(first->command).batch;
+    if (batch != LUA_NOREF)
+    {
+        for (auto msg = first; msg != last; ++msg)
+            _wake(*msg);
+        auto const mark = _profiler.start();
+        // Views to release afterwards, kept apart from the array passed to
+        // the handler in case it modifies that.
+        auto const n = last - first;
+        lua_createtable(L, n, 0);
+        lua_rawgeti(L, LUA_REGISTRYINDEX, batch);
+        lua_pushbackend(L, b);
+        lua_createtable(L, n, 0);
+        for (lua_Integer i = 0; i < n; ++i)
+        {
+            lua_pushborrowedmessage(L, first[i]);
+            lua_pushvalue(L, -1);
+            lua_rawseti(L, pre+1, i+1);
+            lua_rawseti(L, -2, i+1);
+        }
+        auto const result = _call(lowercase(first->command) + "_batch", 2);
+        // How far it got: the messages before the last one it read are done.
+        lua_Integer reached = 0;
+        for (lua_Integer i = 0; i < n; ++i)
+        {
+            lua_rawgeti(L, pre+1, i+1);
+            if (lua_messageread(L, -1))
+                reached = i+1;
+            if (result == CallResult::WAITING)
+                lua_keepmessage(L, -1);
+            else
+                lua_releasemessage(L, -1);
+            lua_pop(L, 1);
+        }
+        lua_settop(L, pre);
+        _profiler.record(first->command, n, mark);
+
+        // Give each message it didn't get to its own chance, so that one bad
+        // message doesn't turn the rest of the run into raw output. Those it
+        // finished aren't handled twice.
+        if (result == CallResult::FAILED)
+        {
+            if (reached > 0)
+                _unhandled(b, first[reached-1]);
+            for (auto msg = first + reached; msg != last; ++msg)
+                _dispatch_single(b, *msg);
+        }
+        return;
+    }
+
+    for (auto msg = first; msg != last; ++msg)
+    {
+        _wake(*msg);
+        _dispatch_single(b, *msg);
+    }
+}
+
+
+void FrontendMessageHandler::_dispatch_single(Backend &b, Message const &msg)
+{
+    // Looked up each time, as a handler may have changed IRC.
+    auto const handlers = _handler(msg.command);
+    auto const ref = handlers.single;
+    if (ref == LUA_NOREF && handlers.native)
+    {
+        _native(b, handlers.native, msg);
+        ++_stats.native;
+        return;
+    }
+    if (ref == LUA_NOREF)
+    {
+        _unhandled(b, msg);
+        ++_stats.unhandled;
+        return;
+    }
+
+    auto const pre = lua_gettop(L);
+    auto const mark = _profiler.start();
+    lua_pushborrowedmessage(L, msg);
+    lua_rawgeti(L, LUA_REGISTRYINDEX, ref);
+    lua_pushbackend(L, b);
+    lua_pushvalue(L, pre+1);
+    auto const result = _call(lowercase(msg.command), 2);
+    if (result == CallResult::FAILED)
+        _unhandled(b, msg);
+    if (result == CallResult::WAITING)
+        lua_keepmessage(L, pre+1);
+    else
+        lua_releasemessage(L, pre+1);
+    lua_settop(L, pre);
+    _profiler.record(msg.command, 1, mark);
+}
+
+
+FrontendMessageHandler::CallResult FrontendMessageHandler::_call(
+    std::string const &handler, int nargs)
+{
+    if (_spare == LUA_NOREF)
+    {
+        lua_newthread(L);
+        _spare = luaL_ref(L, LUA_REGISTRYINDEX);
+    }
+    lua_rawgeti(L, LUA_REGISTRYINDEX, _spare);
+    auto const co = lua_tothread(L, -1);
+    lua_insert(L, -(nargs + 2));
+    lua_xmove(L, co, nargs + 1);
+
+    auto const result = _resume(co, handler, nargs);
+    // Only a coroutine that returned can run another handler.
+    if (result != CallResult::RETURNED)
+    {
+        luaL_unref(L, LUA_REGISTRYINDEX, _spare);
+        _spare = LUA_NOREF;
+    }
+    lua_pop(L, 1);
+    return result;
+}
+
+
+FrontendMessageHandler::CallResult FrontendMessageHandler::_resume(
+    lua_State *co, std::string const &handler, int nargs)
+{
+    ++_stats.calls;
+    auto const name = handler_command(handler);
+    _awaits->running = handler;
+    _watchdog.start(co, name);
+    int nres = 0;
+    int status;
+    {
+        LuaAllocator::Strict const strict{_allocator};
+        status = lua_resume(co, L, nargs, &nres);
+    }
+    auto const outcome = _watchdog.stop(name);
+
+    auto result = CallResult::RETURNED;
+    if (status == LUA_YIELD && nres == 1 && lua_touserdata(co, -1) == _awaits)
+    {
+        lua_pop(co, nres);
+        result = CallResult::WAITING;
+    }
+    else if (status == LUA_YIELD)
+    {
+        lua_debuglog(
+            L,
+            "!!'" + handler + "' handler yielded other than by awaiting; "
+            "dropped it");
+        result = CallResult::FAILED;
+    }
+    else if (status != LUA_OK)
+    {
+        lua_xmove(co, L, 1);
+        try {
+            _guard(status);
+        }
+        catch (std::runtime_error const &e) {
+            lua_debuglog(
+                L, "!!Error in '" + handler + "' handler: " + e.what());
+        }
+        lua_pop(L, 1);
+        result = CallResult::FAILED;
+    }
+    else
+    {
+        lua_settop(co, 0);
+    }
+
+    if (outcome != LuaWatchdog::Outcome::FINISHED)
+        ++_stats.aborted;
+    // Timers are cancelled instead, by 'run_timers'.
+    if (outcome == LuaWatchdog::Outcome::QUARANTINED
+        && !is_timer_handler(name))
+    {
+        lua_debuglog(
+            L,
+            "!!Quarantined the '" + name + "' handlers after "
+            + std::to_string(LuaWatchdog::QUARANTINE_STRIKES)
+            + " aborted calls in a row; assign them again to lift it");
+        invalidate_handlers();
+    }
+    return result;
+}
+
+
+void FrontendMessageHandler::_wake(Message const &msg)
+{
+    if (_awaits->empty())
+        return;
+    for (auto const &waiter : _awaits->take(msg))
+    {
+        if (waiter.timer != 0)
+            luaL_unref(L, LUA_REGISTRYINDEX, _timers->cancel(waiter.timer));
+        lua_rawgeti(L, LUA_REGISTRYINDEX, waiter.ref);
+        luaL_unref(L, LUA_REGISTRYINDEX, waiter.ref);
+        auto const co = lua_tothread(L, -1);
+        auto const mark = _profiler.start();
+        lua_pushmessage(co, msg);
+        _resume(co, waiter.handler, 1);
+        _profiler.record(msg.command, 1, mark);
+        lua_pop(L, 1);
+    }
+}
+
+
+void FrontendMessageHandler::_update_stats()
+{
+    _stats.waiting = _awaits->size();
+    _stats.timers = _timers->size();
+}
+
+
+FrontendMessageHandler::Handlers FrontendMessageHandler::_handler(
+    std::string const &command)
+{
+    if (command.size() == 3
+        && std::isdigit(command[0])
+        && std::isdigit(command[1])
+        && std::isdigit(command[2]))
+    {
+        auto &handlers = _numeric_handlers[
+            (command[0]-'0')*100 + (command[1]-'0')*10 + (command[2]-'0')];
+        if (handlers.single == UNRESOLVED)
+            handlers = _resolve(command);
+        return handlers;
+    }
+
+    auto const it = _named_handlers.find(command);
+    if (it != _named_handlers.cend())
+        return it->second;
+
+    // Don't let junk commands grow the cache forever.
+    if (_named_handlers.size() >= MAX_NAMED_HANDLERS)
+        invalidate_handlers();
+    auto const handlers = _resolve(command);
+    _named_handlers.emplace(command, handlers);
+    return handlers;
+}
+
+
+FrontendMessageHandler::Handlers FrontendMessageHandler::_resolve(
+    std::string const &command)
+{
+    auto const name = lowercase(command);
+    Handlers handlers{};
+    if (_watchdog.quarantined(name))
+    {
+        handlers.single = LUA_NOREF;
+        handlers.batch = LUA_NOREF;
+    }
+    else
+    {
+        lua_getfield(L, LUA_REGISTRYINDEX, HANDLERS_KEY);
+        handlers.single = _ref(name);
+        handlers.batch = _ref(name + "_batch");
+        lua_pop(L, 1);
+    }
+    handlers.native = native_handler(command);
+    return handlers;
+}
+
+
+int FrontendMessageHandler::_ref(std::string const &name)
+{
+    lua_getfield(L, -1, name.c_str());
+    if (lua_isnil(L, -1))
+    {
+        lua_pop(L, 1);
+        return LUA_NOREF;
+    }
+    return luaL_ref(L, LUA_REGISTRYINDEX);
+}
+
+
+
+void FrontendMessageHandler::_native(
+    Backend &b, NativeHandler fn, Message const &msg)
+{
+    if (lua_getdeferred(L))
+        lua_defer(L, [&b, fn, msg](){run_native(b, fn, msg);});
+    else
+        run_native(b, fn, msg);
+}
+
+
+void FrontendMessageHandler::_unhandled(Backend &b, Message const &msg)
+{
+    if (lua_getdeferred(L))
+        lua_defer(L, [&b, msg](){b.get_active_channel().push_message(msg);});
+    else
+        b.get_active_channel().push_message(msg);
+}
+
+
 
 /* ===[ LuaStateDeleter ]=== */
 void FrontendMessageHandler::LuaStateDeleter::operator()(lua_State *L) const
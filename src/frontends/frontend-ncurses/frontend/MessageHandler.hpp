@@ -6,53 +6,288 @@
 #define FRONTENDNCURSES_MESSAGEHANDLER_HPP
 
 #include <Backend.hpp>
+#include <LuaAllocator.hpp>
+#include <LuaProfiler.hpp>
+#include <LuaWatchdog.hpp>
+#include <NativeHandlers.hpp>
 #include <irc/Message.hpp>
 
 #include <lua.hpp>
 
+#include <array>
+#include <chrono>
 #include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 
+class AwaitTable;
 class Frontend;
+class TimerTable;
+struct DeferredBackend;
 
 /**
  * Handles IRC messages for the Frontend.
  *
  * Handling is done through Lua scripts. The handler calls a Lua function
- * corresponding to the command, which then returns a response message (or nil
- * to do nothing).
+ * corresponding to the command, which may send responses through the backend.
  *
  * ### In Lua:
- *  Handler function format: `fn(Message): Message|nil`
+ *  Handler function format: `fn(Backend, Message)`
  *
  *  A global table named `IRC` is where handlers should be installed. Handler
  *  functions must be named after the command they handle, in lowercase.
  *  Example 'PING' handler:
  *
  * ```Lua
- * function IRC.ping(msg)
- *   return Message.new("PONG :"..msg.params(1))
+ * function IRC.ping(b, msg)
+ *   b:respond(Message.pong(msg:params(1)))
  * end
  * ```
+ *
+ *  `IRC` is a proxy for a table kept in the registry, so that handlers can
+ *  be looked up once and cached; assigning to it drops the cache. Scripts
+ *  must not replace `IRC` itself. Commands without a Lua handler use their
+ *  built-in handler, if they have one (see NativeHandlers.hpp), and are
+ *  otherwise written to the active channel; neither enters Lua.
+ *
+ *  The message passed to a handler is only valid until the handler returns;
+ *  use `msg:clone()` to keep it.
+ *
+ *  Scripts are re-run in place when they change on disk (see `reload`), so
+ *  script-level state should be kept in globals initialised like
+ *  `seen = seen or {}`. A handler the script assigned last time but not this
+ *  time is removed, unless another script has since assigned it; handlers
+ *  assigned from inside handlers are left alone.
+ *
+ *  A handler named `<command>_batch`, eg. `IRC.privmsg_batch(b, msgs)`,
+ *  takes precedence over the plain one. It gets each run of consecutive
+ *  messages with that command from one recieved burst as a single array.
+ *  If it fails, the messages after the last one it read (by calling any of
+ *  its methods) are dispatched again on their own, and the one it was on is
+ *  treated as unhandled; those before it were done.
+ *
+ *  Handlers run as coroutines, so they can wait for a reply with
+ *  `b:await(command, value[, param[, timeout]])` while other messages are
+ *  handled; a waiting handler is resumed before the message it waited for
+ *  is handled, or with nil once the timeout passes. `drop_waiters` drops
+ *  them all. Likewise `b:sleep(ms)` pauses a handler for a while.
+ *
+ *  `b:after(ms, fn)` and `b:every(ms, fn)` call `fn(Backend)` later, once
+ *  or repeatedly, and return a Timer to `cancel` them with. The frontend
+ *  calls `run_timers` when `next_timer` comes. Timer functions share the
+ *  budget named "@timer"; a timer whose function is aborted
+ *  LuaWatchdog::QUARANTINE_STRIKES times in a row is cancelled.
+ *
+ *  Each handler call has a time budget, IRCC_LUA_BUDGET_MS milliseconds (0
+ *  for none) or LuaWatchdog::DEFAULT_BUDGET unless set per command; calls
+ *  running over it are aborted with an error. See LuaWatchdog.
  */
 class FrontendMessageHandler
 {
+public:
+    /** Bytes the Lua state may use, unless overridden. */
+    static constexpr size_t DEFAULT_MEMORY_LIMIT = 256 << 20;
+    /** Time 'collect_garbage' should get, to fit well within a frame. */
+    static constexpr std::chrono::microseconds GC_BUDGET{2000};
+
+    struct Stats
+    {
+        /** Messages dispatched. */
+        size_t messages{0};
+        /** Messages with no handler. */
+        size_t unhandled{0};
+        /** Messages handled by built-in handlers. */
+        size_t native{0};
+        /** Calls into Lua handlers. */
+        size_t calls{0};
+        /** Of those, calls aborted for running over their budget. */
+        size_t aborted{0};
+        /** Handlers waiting in `Backend:await` now. */
+        size_t waiting{0};
+        /** Timer functions run. */
+        size_t timer_calls{0};
+        /** Timers pending now, including sleeping handlers. */
+        size_t timers{0};
+        /** Time spent dispatching, including handlers. */
+        std::chrono::nanoseconds time{0};
+        /** Longest time spent dispatching one message or burst. */
+        std::chrono::nanoseconds worst{0};
+    };
+
+private:
     struct LuaStateDeleter
     {
         void operator()(lua_State *L) const;
     };
+    /** Before the state, which they must outlive. */
+    LuaAllocator _allocator;
+    LuaProfiler _profiler{_allocator};
+    LuaWatchdog _watchdog;
     std::unique_ptr<lua_State, LuaStateDeleter> const _L_actual;
     lua_State *const L; // alias for _L_actual
 
+    enum class CallResult
+    {
+        FAILED,
+        RETURNED,
+        /** Waiting in `Backend:await` or `Backend:sleep`. */
+        WAITING,
+    };
+
+    /** Handler reference not looked up yet. */
+    static constexpr int UNRESOLVED = LUA_NOREF - 1;
+    /**
+     * Memory growth (%) before Lua starts a collection itself; above its
+     * default, to leave more of the work to idle time.
+     */
+    static constexpr int GC_PAUSE = 300;
+    /** Work done by each idle GC step, as if this many KiB were allocated. */
+    static constexpr int GC_STEP_KB = 8;
+
+    /** Named commands cached before the cache is flushed. */
+    static constexpr size_t MAX_NAMED_HANDLERS = 256;
+
+    /**
+     * Registry references to a command's Lua handlers, or LUA_NOREF, and
+     * its built-in handler.
+     */
+    struct Handlers
+    {
+        int single{UNRESOLVED};
+        int batch{UNRESOLVED};
+        /** Used if there are no Lua handlers. */
+        NativeHandler native{nullptr};
+    };
+    /** Numerics are indexed by value, other commands by name as recieved. */
+    std::array<Handlers, 1000> _numeric_handlers{};
+    std::unordered_map<std::string, Handlers> _named_handlers{};
+    Stats _stats{};
+    /** Whether handlers may have made garbage since the last GC cycle. */
+    bool _garbage{true};
+    /** Compiled scripts are cached here, if set; see LuaBytecode.hpp. */
+    std::string _bytecode_dir{};
+    /** The script being run, while one is; see `assigned`. */
+    char const *_running{nullptr};
+    /** Handlers assigned while running a script, by the script last to. */
+    std::unordered_map<std::string, char const *> _owners{};
+    /** Handlers assigned by the running script so far. */
+    std::unordered_set<std::string> _assigned{};
+    /** Handlers waiting for messages; owned by L. */
+    AwaitTable *_awaits{nullptr};
+    /** Timers and sleeping handlers; owned by L. */
+    TimerTable *_timers{nullptr};
+    /** Registry reference to a coroutine to run the next handler in. */
+    int _spare{LUA_NOREF};
+
     /** Catches a Lua error and re-throws it as a C++ exception. */
     void _guard(int status) const;
+    /**
+     * lua_pcall, with the memory limit applied strictly; see
+     * LuaAllocator::Strict. Everything else the handler does in L gets some
+     * headroom, so that running out there raises no error outside a
+     * protected call.
+     */
+    int _pcall(int nargs, int nresults);
+    /** Dispatch a run of messages that share a command. */
+    void _dispatch(Backend &b, Message const *first, Message const *last);
+    /**
+     * Dispatch MSG to its single Lua handler, built-in handler or the
+     * active channel, in that order of preference.
+     */
+    void _dispatch_single(Backend &b, Message const &msg);
+    /**
+     * Call the function and its NARGS arguments on the stack, in a
+     * coroutine, as HANDLER, eg. "privmsg" or "join_batch".
+     */
+    CallResult _call(std::string const &handler, int nargs);
+    /**
+     * Resume CO, running HANDLER, with the NARGS values on its stack, under
+     * the watchdog.
+     */
+    CallResult _resume(lua_State *co, std::string const &handler, int nargs);
+    /** Resume the handlers waiting for MSG. */
+    void _wake(Message const &msg);
+    /** Update the stats that are levels rather than counts. */
+    void _update_stats();
+    /** Get the cached handler references for COMMAND. */
+    Handlers _handler(std::string const &command);
+    /** Look up the handlers for COMMAND and reference them. */
+    Handlers _resolve(std::string const &command);
+    /** Reference the field NAME of the table on the stack top, if set. */
+    int _ref(std::string const &name);
+    /** Run a built-in handler, deferred if L is. */
+    void _native(Backend &b, NativeHandler fn, Message const &msg);
+    /** Show a message that wasn't handled. */
+    void _unhandled(Backend &b, Message const &msg);
 
 public:
+    /**
+     * Start a Lua state, limited to IRCC_LUA_MEMORY_MB megabytes (0 for no
+     * limit) or DEFAULT_MEMORY_LIMIT, and run the scripts in it.
+     */
     FrontendMessageHandler();
     /**
      * Execute the command handler for `msg`. Handlers may update the backend.
      */
     void execute(Backend &b, Message const &msg);
+    /** Execute the handlers for a burst of messages, in order. */
+    void execute(Backend &b, std::vector<Message> const &messages);
+    /**
+     * Only resume the handlers waiting for MESSAGES, eg. for messages
+     * another state handles.
+     */
+    void wake(std::vector<Message> const &messages);
+    /** Whether a handler waits for a message with COMMAND. Thread-safe. */
+    bool awaits(std::string const &command) const;
+
+    /** Run the timers that are due, as one batch. */
+    void run_timers(Backend &b);
+    /**
+     * When `run_timers` should next be called, or time_point::max() for
+     * never. Thread-safe.
+     */
+    std::chrono::steady_clock::time_point next_timer() const;
+    /**
+     * Drop the handlers waiting for replies, eg. when the connection closes;
+     * they're never resumed.
+     */
+    void drop_waiters();
+
+    /**
+     * Defer Backend changes made by handlers to D, for running handlers off
+     * the main thread. See LuaDeferred.hpp.
+     */
+    void defer(DeferredBackend &d);
+
+    /**
+     * Re-run the script at PATH, if it's one of ours, in this state. Returns
+     * a line reporting how it went, or "" if PATH isn't a script.
+     */
+    std::string reload(std::string const &path);
+    /** Paths of the scripts run into every state, in order. */
+    static std::vector<std::string> scripts();
+    /** Called by IRC.__newindex when handler NAME is assigned. */
+    void assigned(std::string const &name);
+
+    /**
+     * Run incremental GC steps for up to BUDGET. Returns true if the cycle
+     * isn't finished yet.
+     */
+    bool collect_garbage(std::chrono::microseconds budget);
+
+    /** Drop cached handler references, eg. after `IRC` changes. */
+    void invalidate_handlers();
+
+    Stats const &get_stats() const {return _stats;}
+    /** Lua memory use. Thread-safe. */
+    LuaAllocator::Stats get_memory() const {return _allocator.get_stats();}
+    /** Thread-safe; see LuaProfiler. */
+    LuaProfiler &get_profiler() {return _profiler;}
+    /** Budgets and quarantines are thread-safe; see LuaWatchdog. */
+    LuaWatchdog &get_watchdog() {return _watchdog;}
 };
 
 
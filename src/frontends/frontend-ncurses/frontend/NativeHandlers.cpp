@@ -0,0 +1,144 @@
+/* Copyright (C) 2023 Trevor Last
+ * See LICENSE file for copyright and license details.
+ */
+
+#include "NativeHandlers.hpp"
+
+#include <util/strings.hpp>
+
+#include <stdexcept>
+
+
+/** Parameter I of MSG; throws if it is missing. */
+static std::string const &param(Message const &msg, size_t i)
+{
+    if (i >= msg.params.size())
+    {
+        throw std::runtime_error{
+            msg.command + ": missing parameter " + std::to_string(i+1)};
+    }
+    return msg.params[i];
+}
+
+
+/** Nick from the prefix, eg. "foo" from "foo!bar@baz". */
+static std::string extract_user(Message const &msg)
+{
+    if (!msg.prefix)
+        return {};
+    return msg.prefix->substr(0, msg.prefix->find('!'));
+}
+
+
+static Channel &existing_channel(Backend &b, std::string const &name)
+{
+    auto const channel = b.find_channel(name);
+    if (!channel)
+        throw std::runtime_error{"missing channel '" + name + "'"};
+    return *channel;
+}
+
+
+
+static void handle_ping(Backend &b, Message const &msg)
+{
+    b.send_response(Message{"PONG", {param(msg, 0)}});
+}
+
+
+static void handle_pong(Backend &, Message const &)
+{
+}
+
+
+static void handle_privmsg(Backend &b, Message const &msg)
+{
+    auto const user = extract_user(msg);
+    auto const &text = param(msg, 1);
+    if (auto const channel = b.find_channel(param(msg, 0)))
+    {
+        channel->push_message(user + ": " + text);
+        return;
+    }
+    for (auto const &channel : b.get_channels())
+        channel->push_message(user + " whispers: " + text);
+}
+
+
+static void handle_quit(Backend &b, Message const &msg)
+{
+    auto const user = extract_user(msg);
+    auto line = "<<< " + user + " quit";
+    if (!msg.params.empty())
+        line += ": " + msg.params[0];
+    for (auto const channel : b.get_user_channels(user))
+    {
+        channel->push_message(line);
+        channel->remove_user(user);
+    }
+}
+
+
+static void handle_part(Backend &b, Message const &msg)
+{
+    auto const user = extract_user(msg);
+    auto const &name = param(msg, 0);
+    auto &channel = existing_channel(b, name);
+    channel.push_message("<<< " + user + " left " + name);
+    channel.remove_user(user);
+}
+
+
+static void handle_join(Backend &b, Message const &msg)
+{
+    auto const user = extract_user(msg);
+    auto const &name = param(msg, 0);
+    if (auto const channel = b.find_channel(name))
+    {
+        channel->add_user(user);
+        channel->push_message(">>> " + user + " joined " + name);
+        return;
+    }
+    auto &channel = b.add_channel(name);
+    channel.add_user(user);
+    b.set_active_channel(channel.id);
+}
+
+
+/** RPL_NAMREPLY */
+static void handle_353(Backend &b, Message const &msg)
+{
+    existing_channel(b, param(msg, 2)).add_users(param(msg, 3));
+}
+
+
+/** RPL_ENDOFNAMES */
+static void handle_366(Backend &b, Message const &msg)
+{
+    if (auto const channel = b.find_channel(param(msg, 1)))
+        channel->end_names();
+}
+
+
+
+NativeHandler native_handler(std::string const &command)
+{
+    auto const name = lowercase(command);
+    if (name == "ping")
+        return handle_ping;
+    if (name == "pong")
+        return handle_pong;
+    if (name == "privmsg" || name == "notice")
+        return handle_privmsg;
+    if (name == "quit")
+        return handle_quit;
+    if (name == "part")
+        return handle_part;
+    if (name == "join")
+        return handle_join;
+    if (name == "353")
+        return handle_353;
+    if (name == "366")
+        return handle_366;
+    return nullptr;
+}
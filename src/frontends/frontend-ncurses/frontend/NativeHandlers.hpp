@@ -0,0 +1,30 @@
+/* Copyright (C) 2023 Trevor Last
+ * See LICENSE file for copyright and license details.
+ */
+
+#ifndef FRONTENDNCURSES_NATIVEHANDLERS_HPP
+#define FRONTENDNCURSES_NATIVEHANDLERS_HPP
+
+#include <Backend.hpp>
+#include <irc/Message.hpp>
+
+#include <string>
+
+
+/**
+ * A built-in message handler. Throws std::runtime_error if the message
+ * can't be handled, like a Lua handler raising an error.
+ */
+using NativeHandler = void (*)(Backend &b, Message const &msg);
+
+/**
+ * Get the built-in handler for COMMAND, or nullptr if there is none.
+ *
+ * The commands making up most traffic (PING, PONG, PRIVMSG, NOTICE, JOIN,
+ * PART, QUIT and the NAMES replies 353 and 366) are handled in C++ by
+ * default. Defining a Lua handler for one of them replaces the built-in.
+ */
+NativeHandler native_handler(std::string const &command);
+
+
+#endif
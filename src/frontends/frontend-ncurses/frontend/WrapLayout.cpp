@@ -0,0 +1,86 @@
+/* Copyright (C) 2023 Trevor Last
+ * See LICENSE file for copyright and license details.
+ */
+
+#include "WrapLayout.hpp"
+
+#include <util/utf8.hpp>
+
+
+std::string_view WrapLayout::Line::row(std::string_view text, size_t r) const
+{
+    auto const begin = starts.at(r);
+    auto const end = r + 1 < starts.size()? starts.at(r + 1) : text.size();
+    return text.substr(begin, end - begin);
+}
+
+
+WrapLayout::Line const &WrapLayout::get(
+    size_t n,
+    std::string_view text,
+    size_t text_width,
+    int width)
+{
+    if (width != _width || _lines.size() >= MAX_LINES)
+    {
+        _lines.clear();
+        _width = width;
+    }
+
+    auto const it = _lines.find(n);
+    if (it != _lines.cend())
+        return it->second;
+    return _lines.emplace(n, _layout(text, text_width, width)).first->second;
+}
+
+
+
+/* ==[ Private ]== */
+WrapLayout::Line WrapLayout::_layout(
+    std::string_view text,
+    size_t text_width,
+    int width)
+{
+    Line line{};
+    line.starts.push_back(0);
+    if (width < 1 || text_width <= static_cast<size_t>(width))
+        return line;
+
+    size_t row_start = 0;
+    int column = 0;
+    // Where the row can be broken: just after the last space seen in it, and
+    // the column at that point.
+    size_t last_break = 0;
+    int break_column = 0;
+
+    for (size_t i = 0; i < text.size(); )
+    {
+        auto const begin = i;
+        auto const cp = utf8_decode(text, i);
+        auto const cp_width = codepoint_width(cp);
+
+        while (column + cp_width > width && column > 0)
+        {
+            // Wrap at the last space, or mid-word if the word fills the row.
+            if (last_break > row_start)
+            {
+                row_start = last_break;
+                column -= break_column;
+            }
+            else
+            {
+                row_start = begin;
+                column = 0;
+            }
+            line.starts.push_back(row_start);
+        }
+
+        column += cp_width;
+        if (cp == ' ')
+        {
+            last_break = i;
+            break_column = column;
+        }
+    }
+    return line;
+}
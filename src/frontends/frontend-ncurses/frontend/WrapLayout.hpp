@@ -0,0 +1,56 @@
+/* Copyright (C) 2023 Trevor Last
+ * See LICENSE file for copyright and license details.
+ */
+
+#ifndef FRONTENDNCURSES_WRAPLAYOUT_HPP
+#define FRONTENDNCURSES_WRAPLAYOUT_HPP
+
+#include <cstdint>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+
+/**
+ * Cached word-wrap layout of a channel's scrollback.
+ *
+ * Lines are laid out lazily, the first time they are asked for, and the
+ * result is kept until the width changes. Lines are identified by their
+ * absolute line number, so the cache stays valid as old lines are dropped
+ * from the scrollback.
+ */
+class WrapLayout
+{
+public:
+    struct Line
+    {
+        /** Byte offset where each row starts. Always has at least one row. */
+        std::vector<std::uint32_t> starts{};
+
+        size_t rows() const {return starts.size();}
+        /** Byte range of row R within the line. */
+        std::string_view row(std::string_view text, size_t r) const;
+    };
+
+    /**
+     * Layout of line N at WIDTH columns. TEXT is the line's printable UTF-8
+     * text, and TEXT_WIDTH its display width.
+     */
+    Line const &get(
+        size_t n,
+        std::string_view text,
+        size_t text_width,
+        int width);
+
+private:
+    /** Most lines kept before the cache is flushed. */
+    static constexpr size_t MAX_LINES = 4096;
+
+    int _width{0};
+    std::unordered_map<size_t, Line> _lines{};
+
+    static Line _layout(std::string_view text, size_t text_width, int width);
+};
+
+
+#endif
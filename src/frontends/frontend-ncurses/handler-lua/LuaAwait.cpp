@@ -0,0 +1,150 @@
+/* Copyright (C) 2023 Trevor Last
+ * See LICENSE file for copyright and license details.
+ */
+
+#include "LuaAwait.hpp"
+
+#include <util/strings.hpp>
+
+#include <algorithm>
+#include <new>
+
+
+/** Registry field holding the AwaitTable, as full userdata. */
+static char const *const AWAITS_KEY = "IRCC.awaits";
+
+
+/** Key of a parameter in a command's waiters. */
+static std::string param_key(size_t param, std::string const &value)
+{
+    return std::to_string(param) + ":" + lowercase(value);
+}
+
+
+static int awaits_dunder_gc(lua_State *L)
+{
+    static_cast<AwaitTable *>(lua_touserdata(L, 1))->~AwaitTable();
+    return 0;
+}
+
+
+
+bool AwaitTable::add(
+    std::string const &command, size_t param, std::string const &value,
+    int ref, std::uint64_t timer)
+{
+    if (size() >= MAX_WAITERS)
+        return false;
+    std::lock_guard<std::mutex> lock{_mutex};
+    auto const key = lowercase(command);
+    auto const by_param = param_key(param, value);
+    _waiters[key][by_param].push_back({ref, running, timer});
+    if (timer != 0)
+        _timeouts.emplace(timer, std::make_pair(key, by_param));
+    ++_size;
+    return true;
+}
+
+
+std::vector<AwaitTable::Waiter> AwaitTable::take(Message const &msg)
+{
+    std::vector<Waiter> waiters{};
+    if (empty())
+        return waiters;
+
+    std::lock_guard<std::mutex> lock{_mutex};
+    auto const command = _waiters.find(lowercase(msg.command));
+    if (command == _waiters.cend())
+        return waiters;
+    auto &by_param = command->second;
+    for (size_t i = 0; i < msg.params.size() && !by_param.empty(); ++i)
+    {
+        auto const it = by_param.find(param_key(i+1, msg.params[i]));
+        if (it == by_param.cend())
+            continue;
+        for (auto &waiter : it->second)
+        {
+            if (waiter.timer != 0)
+                _timeouts.erase(waiter.timer);
+            waiters.push_back(std::move(waiter));
+        }
+        by_param.erase(it);
+    }
+    if (by_param.empty())
+        _waiters.erase(command);
+    _size -= waiters.size();
+    return waiters;
+}
+
+
+int AwaitTable::cancel(std::uint64_t timer)
+{
+    if (empty())
+        return LUA_NOREF;
+    std::lock_guard<std::mutex> lock{_mutex};
+    auto const where = _timeouts.find(timer);
+    if (where == _timeouts.cend())
+        return LUA_NOREF;
+    auto const command = _waiters.find(where->second.first);
+    auto const by_param = command->second.find(where->second.second);
+    auto &waiters = by_param->second;
+    auto const it = std::find_if(
+        waiters.begin(), waiters.end(),
+        [timer](auto const &waiter){return waiter.timer == timer;});
+    auto const ref = it->ref;
+    waiters.erase(it);
+    if (waiters.empty())
+        command->second.erase(by_param);
+    if (command->second.empty())
+        _waiters.erase(command);
+    _timeouts.erase(where);
+    --_size;
+    return ref;
+}
+
+
+std::vector<AwaitTable::Waiter> AwaitTable::take_all()
+{
+    std::vector<Waiter> waiters{};
+    std::lock_guard<std::mutex> lock{_mutex};
+    for (auto &command : _waiters)
+        for (auto &by_param : command.second)
+            for (auto &waiter : by_param.second)
+                waiters.push_back(std::move(waiter));
+    _waiters.clear();
+    _timeouts.clear();
+    _size = 0;
+    return waiters;
+}
+
+
+bool AwaitTable::awaits(std::string const &command) const
+{
+    if (empty())
+        return false;
+    std::lock_guard<std::mutex> lock{_mutex};
+    return _waiters.count(lowercase(command)) != 0;
+}
+
+
+
+AwaitTable *lua_newawaits(lua_State *L)
+{
+    auto const awaits = new (lua_newuserdatauv(L, sizeof(AwaitTable), 0))
+        AwaitTable{};
+    lua_createtable(L, 0, 1);
+    lua_pushcfunction(L, awaits_dunder_gc);
+    lua_setfield(L, -2, "__gc");
+    lua_setmetatable(L, -2);
+    lua_setfield(L, LUA_REGISTRYINDEX, AWAITS_KEY);
+    return awaits;
+}
+
+
+AwaitTable *lua_getawaits(lua_State *L)
+{
+    lua_getfield(L, LUA_REGISTRYINDEX, AWAITS_KEY);
+    auto const awaits = static_cast<AwaitTable *>(lua_touserdata(L, -1));
+    lua_pop(L, 1);
+    return awaits;
+}
@@ -0,0 +1,93 @@
+/* Copyright (C) 2023 Trevor Last
+ * See LICENSE file for copyright and license details.
+ */
+
+#ifndef FRONTENDNCURSES_LUAAWAIT_HPP
+#define FRONTENDNCURSES_LUAAWAIT_HPP
+
+#include <irc/Message.hpp>
+
+#include "LuaCompat.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+
+/**
+ * Handler coroutines waiting in `Backend:await` for a message, by command
+ * and the value of one of its parameters, both compared ignoring case.
+ *
+ * Each waiter holds a registry reference to its coroutine, so a waiter costs
+ * little more than the coroutine's stack. A waiter may also have a timeout,
+ * a timer in the state's TimerTable holding a reference of its own. `awaits`
+ * and `empty` may be called from any thread; the rest must be called on the
+ * state's thread.
+ */
+class AwaitTable
+{
+public:
+    /** Most coroutines that may wait at once. */
+    static constexpr size_t MAX_WAITERS = 1 << 16;
+
+    struct Waiter
+    {
+        /** Registry reference to the coroutine. */
+        int ref;
+        /** Handler the coroutine runs, eg. "privmsg" or "join_batch". */
+        std::string handler;
+        /** ID of the timeout's timer, or 0 if there is none. */
+        std::uint64_t timer;
+    };
+
+private:
+    /** By lowercase command, then "<param index>:<lowercase value>". */
+    std::unordered_map<
+        std::string,
+        std::unordered_map<std::string, std::vector<Waiter>>> _waiters{};
+    /** Where the waiters with timeouts are in _waiters, by timer ID. */
+    std::unordered_map<
+        std::uint64_t, std::pair<std::string, std::string>> _timeouts{};
+    std::atomic<size_t> _size{0};
+    mutable std::mutex _mutex{};
+
+public:
+    /** Handler of the coroutine being resumed, recorded by `add`. */
+    std::string running{};
+
+    /**
+     * Add the coroutine REF, waiting for COMMAND with VALUE as parameter
+     * PARAM, counting from 1, until timer TIMER fires if it's non-zero.
+     * Returns false if the table is full.
+     */
+    bool add(
+        std::string const &command, size_t param, std::string const &value,
+        int ref, std::uint64_t timer=0);
+    /** Remove and return the waiters MSG is for. */
+    std::vector<Waiter> take(Message const &msg);
+    /**
+     * Remove the waiter whose timeout is timer TIMER. Returns its
+     * coroutine's reference, or LUA_NOREF if there is none.
+     */
+    int cancel(std::uint64_t timer);
+    /** Remove and return every waiter. */
+    std::vector<Waiter> take_all();
+
+    /** Whether any coroutine waits for a message with COMMAND. */
+    bool awaits(std::string const &command) const;
+    bool empty() const {return _size.load(std::memory_order_relaxed) == 0;}
+    size_t size() const {return _size.load(std::memory_order_relaxed);}
+};
+
+
+/** Give L an await table, which lives as long as L. */
+AwaitTable *lua_newawaits(lua_State *L);
+/** Get L's await table, or nullptr. */
+AwaitTable *lua_getawaits(lua_State *L);
+
+
+#endif
@@ -2,17 +2,27 @@
  * See LICENSE file for copyright and license details.
  */
 
+#include "LuaAwait.hpp"
 #include "LuaBackend.hpp"
 #include "LuaChannel.hpp"
+#include "LuaDeferred.hpp"
 #include "LuaMessage.hpp"
+#include "LuaTimers.hpp"
+
+#include <chrono>
+#include <vector>
+
+
+/** Longest a timer may be set for, in milliseconds: about 24 days. */
+static constexpr lua_Integer MAX_DELAY = 0x7fffffff;
 
 
 /**
  * 1. Backend:active_channel() -> Channel
- * 2. Backend:active_channel(channel: String)
+ * 2. Backend:active_channel(channel: String|int)
  *
  * 1. Get the active channel.
- * 2. Set the active channel.
+ * 2. Set the active channel, by name or ID.
  */
 static int backend__active_channel(lua_State *L);
 
@@ -24,27 +34,96 @@ static int backend__active_channel(lua_State *L);
 static int backend__add_channel(lua_State *L);
 
 /**
- * 1. Backend:prefix() -> array[Channel]
- * 2. Backend:prefix(channel_name: String) -> Channel
+ * Backend:after(ms: int, fn: function(Backend)) -> Timer
+ *
+ * Call FN once, MS milliseconds from now. Returns a Timer, whose `cancel`
+ * method stops it. Timers that come due together are run as one batch.
+ */
+static int backend__after(lua_State *L);
+
+/**
+ * Backend:await(command: String, value: String, param: int=1,
+ *               timeout: int=nil) -> Message|nil
  *
- * 1. Get the list of active channels.
- * 2. Get a specific channel. Returns nil if the channel does not exist.
+ * Wait for the next message with COMMAND whose PARAMth parameter is VALUE,
+ * both ignoring case, and return a copy of it; eg. `b:await("318", nick, 2)`
+ * for the end of a WHOIS reply. Returns nil if TIMEOUT milliseconds pass
+ * first. Only handlers can wait, as they run as coroutines; other messages
+ * are handled meanwhile. The handler's own message stays valid. Waiters are
+ * dropped if the connection closes.
+ */
+static int backend__await(lua_State *L);
+
+/**
+ * 1. Backend:channels() -> array[Channel]
+ * 2. Backend:channels(channel: String|int) -> Channel
+ *
+ * 1. Get the list of channels, in the order they were added.
+ * 2. Get a specific channel, by name or ID. Returns nil if the channel does
+ *    not exist.
  */
 static int backend__channels(lua_State *L);
 
 /**
- * Backend:respond(msg: Message)
+ * 1. Backend:casemapping() -> String
+ * 2. Backend:casemapping(name: String)
+ *
+ * 1. Get the casemapping used to compare nicks.
+ * 2. Set the casemapping, by its ISUPPORT name (eg. "rfc1459").
+ */
+static int backend__casemapping(lua_State *L);
+
+/**
+ * Backend:every(ms: int, fn: function(Backend)) -> Timer
+ *
+ * Call FN every MS milliseconds, until the returned Timer is cancelled. Calls
+ * missed while the client was busy are skipped, not made up.
+ */
+static int backend__every(lua_State *L);
+
+/**
+ * Backend:rename_user(from: String, to: String)
+ *
+ * Change a user's nick in every channel they're in.
+ */
+static int backend__rename_user(lua_State *L);
+
+/**
+ * Backend:respond(msgs: Message...)
  *
- * Send a message over IRC.
+ * Send messages over IRC, in order. Takes what the Message constructors
+ * return as it is, eg. `b:respond(Message.privmsg(target, text))`.
  */
 static int backend__respond(lua_State *L);
 
+/**
+ * Backend:sleep(ms: int)
+ *
+ * Pause the handler for MS milliseconds; other messages are handled
+ * meanwhile. Only handlers and timer functions can sleep.
+ */
+static int backend__sleep(lua_State *L);
+
+/**
+ * Backend:user_channels(nick: String) -> array[Channel]
+ *
+ * Get the channels a user is in, in the order they were added.
+ */
+static int backend__user_channels(lua_State *L);
+
 
 static const luaL_Reg backendlib_m[] = {
     {"active_channel", backend__active_channel},
     {"add_channel", backend__add_channel},
+    {"after", backend__after},
+    {"await", backend__await},
+    {"casemapping", backend__casemapping},
     {"channels", backend__channels},
+    {"every", backend__every},
+    {"rename_user", backend__rename_user},
     {"respond", backend__respond},
+    {"sleep", backend__sleep},
+    {"user_channels", backend__user_channels},
     {nullptr, nullptr}
 };
 
@@ -95,11 +174,17 @@ static int backend__channels1(lua_State *L)
 {
     auto const b = luaL_checkbackend(L, 1);
 
-    lua_newtable(L);
+    std::vector<Channel *> channels{};
+    {
+        auto const lock = lua_readlock(L);
+        for (auto const &channel : b->get_channels())
+            channels.push_back(channel.get());
+    }
+    lua_createtable(L, channels.size(), 0);
     size_t i = 1;
-    for (auto &kv : b->get_channels())
+    for (auto const channel : channels)
     {
-        lua_pushchannel(L, kv.second);
+        lua_pushchannel(L, *channel);
         lua_seti(L, -2, i++);
     }
     return 1;
@@ -108,15 +193,26 @@ static int backend__channels1(lua_State *L)
 static int backend__channels2(lua_State *L)
 {
     auto const b = luaL_checkbackend(L, 1);
-    std::string const name{luaL_checkstring(L, 2)};
 
-    auto &channels = b->get_channels();
-    try {
-        lua_pushchannel(L, channels.at(name));
+    Channel *channel = nullptr;
+    if (lua_isinteger(L, 2))
+    {
+        auto const id = lua_tointeger(L, 2);
+        auto const lock = lua_readlock(L);
+        if (id >= 0 && static_cast<size_t>(id) < b->get_channels().size())
+            channel = &b->get_channel(id);
     }
-    catch (std::out_of_range const &e) {
-        lua_pushnil(L);
+    else
+    {
+        std::string const name{luaL_checkstring(L, 2)};
+        auto const lock = lua_readlock(L);
+        channel = b->find_channel(name);
     }
+
+    if (channel)
+        lua_pushchannel(L, *channel);
+    else
+        lua_pushnil(L);
     return 1;
 }
 
@@ -126,12 +222,35 @@ static int backend__active_channel(lua_State *L)
     auto const b = luaL_checkbackend(L, 1);
     switch (lua_gettop(L))
     {
-    case 1:
-        lua_pushchannel(L, b->get_active_channel());
-        return 1;
-    case 2:
-        b->set_active_channel(luaL_checkstring(L, 2));
-        return 0;
+    case 1:{
+        Channel *channel;
+        {
+            auto const lock = lua_readlock(L);
+            channel = &b->get_active_channel();
+        }
+        lua_pushchannel(L, *channel);
+        return 1;}
+    case 2:{
+        // Look the channel up now, so a bad name is an error even when the
+        // change is deferred.
+        Channel *channel = nullptr;
+        if (lua_isinteger(L, 2))
+        {
+            auto const id = lua_tointeger(L, 2);
+            auto const lock = lua_readlock(L);
+            if (id >= 0 && static_cast<size_t>(id) < b->get_channels().size())
+                channel = &b->get_channel(id);
+        }
+        else
+        {
+            std::string const name{luaL_checkstring(L, 2)};
+            auto const lock = lua_readlock(L);
+            channel = b->find_channel(name);
+        }
+        if (!channel)
+            return luaL_error(L, "no such channel");
+        lua_defer(L, [b, channel](){b->set_active_channel(channel->id);});
+        return 0;}
     }
     return luaL_error(L, "too many args");
 }
@@ -140,18 +259,218 @@ static int backend__active_channel(lua_State *L)
 static int backend__add_channel(lua_State *L)
 {
     auto const b = luaL_checkbackend(L, 1);
-    auto const s = luaL_checkstring(L, 2);
-    auto kv = b->get_channels().emplace(s, s);
-    auto &ch = kv.first->second;
-    lua_pushchannel(L, ch);
+    std::string const name{luaL_checkstring(L, 2)};
+
+    // The new channel is needed right away, so this isn't deferred.
+    Channel *channel;
+    {
+        auto const lock = lua_writelock(L);
+        channel = &b->add_channel(name);
+    }
+    lua_pushchannel(L, *channel);
+    return 1;
+}
+
+
+/** Push a Timer calling the function at index 3 after the delay at 2. */
+static int add_timer(lua_State *L, bool repeat)
+{
+    luaL_checkbackend(L, 1);
+    auto const ms = luaL_checkinteger(L, 2);
+    luaL_argcheck(
+        L, ms >= (repeat? 1 : 0) && ms <= MAX_DELAY, 2, "out of range");
+    luaL_checktype(L, 3, LUA_TFUNCTION);
+
+    auto const timers = lua_gettimers(L);
+    if (!timers)
+        return luaL_error(L, "timers aren't available here");
+    std::chrono::milliseconds const delay{ms};
+    lua_pushvalue(L, 3);
+    auto const ref = luaL_ref(L, LUA_REGISTRYINDEX);
+    auto const id = timers->add(
+        TimerTable::Clock::now() + delay,
+        repeat? delay : std::chrono::milliseconds{0}, ref);
+    if (id == 0)
+    {
+        luaL_unref(L, LUA_REGISTRYINDEX, ref);
+        return luaL_error(L, "too many timers");
+    }
+    lua_pushtimer(L, id);
     return 1;
 }
 
 
+static int backend__after(lua_State *L)
+{
+    return add_timer(L, false);
+}
+
+
+static int backend__await(lua_State *L)
+{
+    luaL_checkbackend(L, 1);
+    auto const command = luaL_checkstring(L, 2);
+    auto const value = luaL_checkstring(L, 3);
+    auto const param = luaL_optinteger(L, 4, 1);
+    luaL_argcheck(L, param >= 1 && param <= 15, 4, "no such param");
+    bool const timed = !lua_isnoneornil(L, 5);
+    auto const timeout = timed? luaL_checkinteger(L, 5) : 0;
+    luaL_argcheck(L, timeout >= 0 && timeout <= MAX_DELAY, 5, "out of range");
+
+    auto const awaits = lua_getawaits(L);
+    auto const timers = lua_gettimers(L);
+    if (!awaits || !lua_isyieldable(L) || (timed && !timers))
+        return luaL_error(L, "can only await in a handler");
+    lua_pushthread(L);
+    auto const ref = luaL_ref(L, LUA_REGISTRYINDEX);
+    // No C++ objects may be left on the stack when yielding, as it doesn't
+    // unwind it.
+    std::uint64_t timer = 0;
+    if (timed)
+    {
+        lua_pushthread(L);
+        auto const timer_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+        timer = timers->add(
+            TimerTable::Clock::now() + std::chrono::milliseconds{timeout},
+            std::chrono::milliseconds{0}, timer_ref, awaits->running);
+        if (timer == 0)
+        {
+            luaL_unref(L, LUA_REGISTRYINDEX, timer_ref);
+            luaL_unref(L, LUA_REGISTRYINDEX, ref);
+            return luaL_error(L, "too many timers");
+        }
+    }
+    if (!awaits->add(command, param, value, ref, timer))
+    {
+        luaL_unref(L, LUA_REGISTRYINDEX, ref);
+        if (timer != 0)
+            luaL_unref(L, LUA_REGISTRYINDEX, timers->cancel(timer));
+        return luaL_error(L, "too many handlers waiting");
+    }
+    // Tells the handler apart from one that yielded some other way.
+    lua_pushlightuserdata(L, awaits);
+    return lua_yield(L, 1);
+}
+
+
+static int backend__casemapping(lua_State *L)
+{
+    auto const b = luaL_checkbackend(L, 1);
+    switch (lua_gettop(L))
+    {
+    case 1:{
+        CaseMapping mapping;
+        {
+            auto const lock = lua_readlock(L);
+            mapping = b->get_casemapping();
+        }
+        switch (mapping)
+        {
+        case CaseMapping::ASCII:
+            lua_pushstring(L, "ascii");
+            break;
+        case CaseMapping::RFC1459:
+            lua_pushstring(L, "rfc1459");
+            break;
+        case CaseMapping::STRICT_RFC1459:
+            lua_pushstring(L, "strict-rfc1459");
+            break;
+        }
+        return 1;}
+    case 2:{
+        auto const mapping = parse_casemapping(luaL_checkstring(L, 2));
+        lua_defer(L, [b, mapping](){b->set_casemapping(mapping);});
+        return 0;}
+    }
+    return luaL_error(L, "too many args");
+}
+
+
+static int backend__every(lua_State *L)
+{
+    return add_timer(L, true);
+}
+
+
+static int backend__rename_user(lua_State *L)
+{
+    auto const b = luaL_checkbackend(L, 1);
+    std::string const from{luaL_checkstring(L, 2)};
+    std::string const to{luaL_checkstring(L, 3)};
+    lua_defer(L, [b, from, to](){b->rename_user(from, to);});
+    return 0;
+}
+
+
 static int backend__respond(lua_State *L)
 {
     auto const b = luaL_checkbackend(L, 1);
-    auto const msg = luaL_checkmessage(L, 2);
-    b->send_response(*msg);
+    auto const top = lua_gettop(L);
+    for (int i = 2; i <= top; ++i)
+        luaL_checkmessage(L, i);
+    if (lua_getdeferred(L))
+    {
+        std::vector<Message> msgs{};
+        for (int i = 2; i <= top; ++i)
+            msgs.push_back(*luaL_checkmessage(L, i));
+        lua_defer(
+            L, [b, msgs=std::move(msgs)]()
+            {
+                for (auto const &msg : msgs)
+                    b->send_response(msg);
+            });
+    }
+    else
+    {
+        for (int i = 2; i <= top; ++i)
+            b->send_response(*luaL_checkmessage(L, i));
+    }
     return 0;
 }
+
+
+static int backend__sleep(lua_State *L)
+{
+    luaL_checkbackend(L, 1);
+    auto const ms = luaL_checkinteger(L, 2);
+    luaL_argcheck(L, ms >= 0 && ms <= MAX_DELAY, 2, "out of range");
+
+    auto const timers = lua_gettimers(L);
+    auto const awaits = lua_getawaits(L);
+    if (!timers || !awaits || !lua_isyieldable(L))
+        return luaL_error(L, "can only sleep in a handler");
+    lua_pushthread(L);
+    auto const ref = luaL_ref(L, LUA_REGISTRYINDEX);
+    // As in await, nothing of C++'s may be left on the stack.
+    if (!timers->add(
+            TimerTable::Clock::now() + std::chrono::milliseconds{ms},
+            std::chrono::milliseconds{0}, ref, awaits->running))
+    {
+        luaL_unref(L, LUA_REGISTRYINDEX, ref);
+        return luaL_error(L, "too many timers");
+    }
+    lua_pushlightuserdata(L, awaits);
+    return lua_yield(L, 1);
+}
+
+
+static int backend__user_channels(lua_State *L)
+{
+    auto const b = luaL_checkbackend(L, 1);
+    std::string const nick{luaL_checkstring(L, 2)};
+
+    std::vector<Channel *> channels;
+    {
+        auto const lock = lua_readlock(L);
+        channels = b->get_user_channels(nick);
+    }
+    lua_createtable(L, channels.size(), 0);
+    size_t i = 1;
+    for (auto const channel : channels)
+    {
+        lua_pushchannel(L, *channel);
+        lua_seti(L, -2, i++);
+    }
+    return 1;
+}
+
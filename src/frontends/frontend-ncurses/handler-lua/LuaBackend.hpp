@@ -7,7 +7,7 @@
 
 #include <Backend.hpp>
 
-#include <lua.hpp>
+#include "LuaCompat.hpp"
 
 
 /** Open the Backend library. */
@@ -0,0 +1,127 @@
+/* Copyright (C) 2023 Trevor Last
+ * See LICENSE file for copyright and license details.
+ */
+
+#include "LuaBytecode.hpp"
+
+#include <util/debug.hpp>
+
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+
+
+/** Identifies the Lua build, as bytecode only loads into the same one. */
+#ifdef IRCC_LUAJIT
+static char const *const BUILD = LUA_RELEASE " (LuaJIT)";
+#else
+static char const *const BUILD = LUA_RELEASE;
+#endif
+
+
+static std::uint64_t fnv1a(std::string const &data)
+{
+    std::uint64_t hash = 0xcbf29ce484222325;
+    for (unsigned char const ch : data)
+    {
+        hash ^= ch;
+        hash *= 0x100000001b3;
+    }
+    return hash;
+}
+
+
+/** Header of the cached copy of source with hash HASH. */
+static std::string cache_header(std::uint64_t hash)
+{
+    char hex[17];
+    std::snprintf(
+        hex, sizeof(hex), "%016llx", static_cast<unsigned long long>(hash));
+    return std::string{"IRCC bytecode "} + BUILD + " " + hex + "\n";
+}
+
+
+static bool read_file(std::string const &path, std::string &out)
+{
+    std::ifstream in{path, std::ios::binary};
+    if (!in)
+        return false;
+    out.assign(
+        std::istreambuf_iterator<char>{in}, std::istreambuf_iterator<char>{});
+    return !in.bad();
+}
+
+
+/** lua_Writer appending to a std::string. */
+static int string_writer(lua_State *, void const *p, size_t size, void *ud)
+{
+    static_cast<std::string *>(ud)->append(static_cast<char const *>(p), size);
+    return 0;
+}
+
+
+
+int lua_loadcached(
+    lua_State *L, std::string const &path, std::string const &cache_dir,
+    bool *hit)
+{
+    if (hit)
+        *hit = false;
+    std::string source{};
+    if (!read_file(path, source))
+        return luaL_loadfile(L, path.c_str()); // for its error message
+
+    auto const chunkname = "@" + path;
+    std::string cache_path{};
+    std::string header{};
+    if (!cache_dir.empty())
+    {
+        auto name = path;
+        for (auto &ch : name)
+            if (ch == '/')
+                ch = '_';
+        cache_path = cache_dir + "/" + name + ".luac";
+        header = cache_header(fnv1a(source));
+
+        std::string cached{};
+        if (read_file(cache_path, cached)
+            && cached.compare(0, header.size(), header) == 0)
+        {
+            auto const status = luaL_loadbuffer(
+                L, cached.data() + header.size(),
+                cached.size() - header.size(), chunkname.c_str());
+            if (status == LUA_OK)
+            {
+                if (hit)
+                    *hit = true;
+                return LUA_OK;
+            }
+            lua_pop(L, 1);
+        }
+    }
+
+    // Like luaL_loadfile, skip a '#!' line, keeping the line numbers.
+    if (!source.empty() && source[0] == '#')
+        source.erase(0, source.find('\n'));
+    auto const status = luaL_loadbuffer(
+        L, source.data(), source.size(), chunkname.c_str());
+    if (status != LUA_OK || cache_path.empty())
+        return status;
+
+    // Written whole and renamed over the old copy, so it's never half there.
+    auto bytecode = header;
+    lua_dump(L, string_writer, &bytecode, 0);
+    auto const tmp_path = cache_path + ".tmp";
+    {
+        std::ofstream out{tmp_path, std::ios::binary | std::ios::trunc};
+        out.write(bytecode.data(), bytecode.size());
+        out.close();
+        if (out && std::rename(tmp_path.c_str(), cache_path.c_str()) == 0)
+            return LUA_OK;
+    }
+    std::remove(tmp_path.c_str());
+    debugstream << "!!Couldn't cache bytecode for " << path << " in "
+        << cache_dir << std::endl;
+    return LUA_OK;
+}
@@ -0,0 +1,32 @@
+/* Copyright (C) 2023 Trevor Last
+ * See LICENSE file for copyright and license details.
+ */
+
+#ifndef FRONTENDNCURSES_LUABYTECODE_HPP
+#define FRONTENDNCURSES_LUABYTECODE_HPP
+
+#include "LuaCompat.hpp"
+
+#include <string>
+
+
+/*
+ * Compiled scripts are cached as files in a directory, one per script, each
+ * holding the chunk dumped by lua_dump after a header naming the Lua build
+ * and the FNV-1a hash of the source it was compiled from. A cached chunk is
+ * only used while the source still hashes the same.
+ */
+
+/**
+ * Load the script at PATH like luaL_loadfile, from its compiled copy in
+ * CACHE_DIR if that is up to date. Otherwise the source is compiled and the
+ * cache refreshed; failing to write it is logged, not an error. An empty
+ * CACHE_DIR disables the cache. If HIT is given, it's set to whether the
+ * cache was used.
+ */
+int lua_loadcached(
+    lua_State *L, std::string const &path, std::string const &cache_dir,
+    bool *hit=nullptr);
+
+
+#endif
@@ -3,8 +3,16 @@
  */
 
 #include "LuaChannel.hpp"
+#include "LuaDeferred.hpp"
 
 
+/**
+ * Channel:id() -> int
+ *
+ * Get the channel's ID, for use with Backend:channels(id).
+ */
+static int channel__id(lua_State *L);
+
 /**
  * Channel:name() -> String
  *
@@ -26,6 +34,26 @@ static int channel__write(lua_State *L);
  */
 static int channel__add_user(lua_State *L);
 
+/**
+ * 1. Channel:add_users(names: String)
+ * 2. Channel:add_users(names: array[String])
+ *
+ * Add several users at once, eg. from a NAMES reply. Mode prefixes like '@'
+ * are stripped from the names. The user list isn't sorted until
+ * Channel:end_names() is called.
+ *
+ * 1. NAMES is a space-separated list.
+ * 2. NAMES is an array of names.
+ */
+static int channel__add_users(lua_State *L);
+
+/**
+ * Channel:end_names()
+ *
+ * Finish adding users from a NAMES reply.
+ */
+static int channel__end_names(lua_State *L);
+
 /**
  * Channel:remove_user(user: String)
  *
@@ -33,11 +61,34 @@ static int channel__add_user(lua_State *L);
  */
 static int channel__remove_user(lua_State *L);
 
+/**
+ * 1. Channel:scrollback_limits() -> int, int
+ * 2. Channel:scrollback_limits(lines: int, bytes: int)
+ *
+ * 1. Get the scrollback line and byte limits.
+ * 2. Set the scrollback line and byte limits.
+ */
+static int channel__scrollback_limits(lua_State *L);
+
+/**
+ * Channel:scrollback_usage() -> int, int, int
+ *
+ * Get the number of scrollback lines, the bytes they use, and the total bytes
+ * held by the scrollback.
+ */
+static int channel__scrollback_usage(lua_State *L);
+
 
 static const luaL_Reg channellib_m[] = {
+    {"id", channel__id},
+    {"name", channel__name},
     {"write", channel__write},
     {"add_user", channel__add_user},
+    {"add_users", channel__add_users},
+    {"end_names", channel__end_names},
     {"remove_user", channel__remove_user},
+    {"scrollback_limits", channel__scrollback_limits},
+    {"scrollback_usage", channel__scrollback_usage},
     {nullptr, nullptr}
 };
 
@@ -71,6 +122,13 @@ Channel *luaL_checkchannel(lua_State *L, int arg)
 
 
 
+static int channel__id(lua_State *L)
+{
+    auto const c = luaL_checkchannel(L, 1);
+    lua_pushinteger(L, c->id);
+    return 1;
+}
+
 static int channel__name(lua_State *L)
 {
     auto const c = luaL_checkchannel(L, 1);
@@ -81,23 +139,107 @@ static int channel__name(lua_State *L)
 static int channel__write(lua_State *L)
 {
     auto const c = luaL_checkchannel(L, 1);
-    auto const str = luaL_checkstring(L, 2);
-    c->push_message(str);
+    std::string str{luaL_checkstring(L, 2)};
+    lua_defer(L, [c, str=std::move(str)](){c->push_message(str);});
     return 0;
 }
 
 static int channel__add_user(lua_State *L)
 {
     auto const c = luaL_checkchannel(L, 1);
-    auto const user = luaL_checkstring(L, 2);
-    c->add_user(user);
+    std::string user{luaL_checkstring(L, 2)};
+    lua_defer(L, [c, user=std::move(user)](){c->add_user(user);});
+    return 0;
+}
+
+static int channel__add_users(lua_State *L)
+{
+    auto const c = luaL_checkchannel(L, 1);
+    if (lua_type(L, 2) == LUA_TTABLE)
+    {
+        // Join the array into one list, so it goes through the same path.
+        luaL_Buffer buf;
+        luaL_buffinit(L, &buf);
+        auto const n = luaL_len(L, 2);
+        for (lua_Integer i = 1; i <= n; ++i)
+        {
+            lua_geti(L, 2, i);
+            size_t len;
+            auto const name = luaL_checklstring(L, -1, &len);
+            lua_pop(L, 1);
+            luaL_addlstring(&buf, name, len);
+            luaL_addlstring(&buf, " ", 1);
+        }
+        luaL_pushresult(&buf);
+        lua_replace(L, 2);
+    }
+
+    size_t len;
+    auto const names = luaL_checklstring(L, 2, &len);
+    if (lua_getdeferred(L))
+        lua_defer(L, [c, names=std::string{names, len}](){
+            c->add_users(names);});
+    else
+        c->add_users({names, len});
+    return 0;
+}
+
+static int channel__end_names(lua_State *L)
+{
+    auto const c = luaL_checkchannel(L, 1);
+    lua_defer(L, [c](){c->end_names();});
     return 0;
 }
 
 static int channel__remove_user(lua_State *L)
 {
     auto const c = luaL_checkchannel(L, 1);
-    auto const user = luaL_checkstring(L, 2);
-    c->remove_user(user);
+    std::string user{luaL_checkstring(L, 2)};
+    lua_defer(L, [c, user=std::move(user)](){c->remove_user(user);});
     return 0;
 }
+
+static int channel__scrollback_limits(lua_State *L)
+{
+    auto const c = luaL_checkchannel(L, 1);
+    switch (lua_gettop(L))
+    {
+    case 1:{
+        Scrollback::Limits limits;
+        {
+            auto const lock = lua_readlock(L);
+            limits = c->get_scrollback().get_limits();
+        }
+        lua_pushinteger(L, limits.lines);
+        lua_pushinteger(L, limits.bytes);
+        return 2;}
+    case 3:{
+        auto const lines = luaL_checkinteger(L, 2);
+        auto const bytes = luaL_checkinteger(L, 3);
+        luaL_argcheck(L, lines > 0, 2, "must be positive");
+        luaL_argcheck(L, bytes > 0, 3, "must be positive");
+        Scrollback::Limits const limits{
+            static_cast<size_t>(lines),
+            static_cast<size_t>(bytes)};
+        lua_defer(L, [c, limits](){c->set_scrollback_limits(limits);});
+        return 0;}
+    }
+    return luaL_error(L, "bad arg count");
+}
+
+static int channel__scrollback_usage(lua_State *L)
+{
+    auto const c = luaL_checkchannel(L, 1);
+    size_t size, bytes, footprint;
+    {
+        auto const lock = lua_readlock(L);
+        auto const &scrollback = c->get_scrollback();
+        size = scrollback.size();
+        bytes = scrollback.bytes();
+        footprint = scrollback.footprint();
+    }
+    lua_pushinteger(L, size);
+    lua_pushinteger(L, bytes);
+    lua_pushinteger(L, footprint);
+    return 3;
+}
@@ -7,7 +7,7 @@
 
 #include <Channel.hpp>
 
-#include <lua.hpp>
+#include "LuaCompat.hpp"
 
 
 /** Open the Channel library. */
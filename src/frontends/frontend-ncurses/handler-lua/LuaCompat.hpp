@@ -0,0 +1,153 @@
+/* Copyright (C) 2023 Trevor Last
+ * See LICENSE file for copyright and license details.
+ */
+
+#ifndef FRONTENDNCURSES_LUACOMPAT_HPP
+#define FRONTENDNCURSES_LUACOMPAT_HPP
+
+#include <lua.hpp>
+
+
+/*
+ * The handlers are written against the Lua 5.4 API. LuaJIT 2.1 implements
+ * the 5.1 API plus a few 5.2 functions; the rest of what we use is filled in
+ * here. LuaJIT must be built with LUAJIT_ENABLE_LUA52COMPAT for scripts to be
+ * able to iterate over `IRC` with pairs().
+ */
+#if LUA_VERSION_NUM < 502
+
+#ifndef LUA_OK
+#define LUA_OK 0
+#endif
+
+#ifndef luaL_newlib
+#define luaL_newlib(L, l) \
+    (lua_createtable(L, 0, sizeof(l)/sizeof((l)[0]) - 1), \
+     luaL_setfuncs(L, l, 0))
+#endif
+
+#define luaL_checkversion(L) ((void)(L))
+
+
+inline int lua_absindex(lua_State *L, int idx)
+{
+    return (idx > 0 || idx <= LUA_REGISTRYINDEX)? idx : lua_gettop(L)+idx+1;
+}
+
+
+inline int lua_geti(lua_State *L, int idx, lua_Integer n)
+{
+    idx = lua_absindex(L, idx);
+    lua_pushinteger(L, n);
+    lua_gettable(L, idx);
+    return lua_type(L, -1);
+}
+
+
+inline void lua_seti(lua_State *L, int idx, lua_Integer n)
+{
+    idx = lua_absindex(L, idx);
+    lua_pushinteger(L, n);
+    lua_insert(L, -2);
+    lua_settable(L, idx);
+}
+
+
+inline int lua_isinteger(lua_State *L, int idx)
+{
+    if (lua_type(L, idx) != LUA_TNUMBER)
+        return 0;
+    auto const n = lua_tonumber(L, idx);
+    return n == static_cast<lua_Number>(static_cast<lua_Integer>(n));
+}
+
+
+/** Userdata don't have user values; LuaJIT has environment tables instead. */
+inline void *lua_newuserdatauv(lua_State *L, size_t size, int)
+{
+    return lua_newuserdata(L, size);
+}
+
+
+/** Ignores __len, which 5.1 doesn't have for tables. */
+inline lua_Integer luaL_len(lua_State *L, int idx)
+{
+    return lua_objlen(L, idx);
+}
+
+
+inline char const *luaL_tolstring(lua_State *L, int idx, size_t *len)
+{
+    idx = lua_absindex(L, idx);
+    if (luaL_callmeta(L, idx, "__tostring"))
+    {
+        if (!lua_isstring(L, -1))
+            luaL_error(L, "'__tostring' must return a string");
+    }
+    else switch (lua_type(L, idx))
+    {
+    case LUA_TNUMBER:
+    case LUA_TSTRING:
+        lua_pushvalue(L, idx);
+        break;
+    case LUA_TBOOLEAN:
+        lua_pushstring(L, lua_toboolean(L, idx)? "true" : "false");
+        break;
+    case LUA_TNIL:
+        lua_pushstring(L, "nil");
+        break;
+    default:
+        lua_pushfstring(
+            L, "%s: %p", luaL_typename(L, idx), lua_topointer(L, idx));
+        break;
+    }
+    return lua_tolstring(L, -1, len);
+}
+
+
+/** Can't strip debug info. */
+inline int lua_dump(lua_State *L, lua_Writer writer, void *data, int)
+{
+    return lua_dump(L, writer, data);
+}
+
+
+/** NRES is set to everything on L's stack, which is what 5.1 leaves. */
+inline int lua_resume(lua_State *L, lua_State *, int narg, int *nres)
+{
+    auto const status = lua_resume(L, narg);
+    *nres = lua_gettop(L);
+    return status;
+}
+
+
+/** Only tells the main thread apart; 5.1 can't yield across C calls. */
+inline int lua_isyieldable(lua_State *L)
+{
+    auto const main = lua_pushthread(L);
+    lua_pop(L, 1);
+    return !main;
+}
+
+
+inline void luaL_requiref(
+    lua_State *L, char const *modname, lua_CFunction openf, int glb)
+{
+    lua_pushcfunction(L, openf);
+    lua_pushstring(L, modname);
+    lua_call(L, 1, 1);
+    lua_getfield(L, LUA_REGISTRYINDEX, "_LOADED");
+    lua_pushvalue(L, -2);
+    lua_setfield(L, -2, modname);
+    lua_pop(L, 1);
+    if (glb)
+    {
+        lua_pushvalue(L, -1);
+        lua_setglobal(L, modname);
+    }
+}
+
+#endif
+
+
+#endif
@@ -0,0 +1,50 @@
+/* Copyright (C) 2023 Trevor Last
+ * See LICENSE file for copyright and license details.
+ */
+
+#include "LuaDeferred.hpp"
+
+#include <util/debug.hpp>
+
+
+/** Registry field holding the DeferredBackend, as light userdata. */
+static char const *const DEFERRED_KEY = "IRCC.deferred";
+
+
+
+void lua_setdeferred(lua_State *L, DeferredBackend *d)
+{
+    lua_pushlightuserdata(L, d);
+    lua_setfield(L, LUA_REGISTRYINDEX, DEFERRED_KEY);
+}
+
+
+DeferredBackend *lua_getdeferred(lua_State *L)
+{
+    lua_getfield(L, LUA_REGISTRYINDEX, DEFERRED_KEY);
+    auto const d = static_cast<DeferredBackend *>(lua_touserdata(L, -1));
+    lua_pop(L, 1);
+    return d;
+}
+
+
+std::shared_lock<std::shared_mutex> lua_readlock(lua_State *L)
+{
+    if (auto const d = lua_getdeferred(L))
+        return std::shared_lock<std::shared_mutex>{*d->mutex};
+    return {};
+}
+
+
+std::unique_lock<std::shared_mutex> lua_writelock(lua_State *L)
+{
+    if (auto const d = lua_getdeferred(L))
+        return std::unique_lock<std::shared_mutex>{*d->mutex};
+    return {};
+}
+
+
+void lua_debuglog(lua_State *L, std::string line)
+{
+    lua_defer(L, [line=std::move(line)](){debugstream << line << std::endl;});
+}
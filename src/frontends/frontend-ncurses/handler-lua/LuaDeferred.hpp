@@ -0,0 +1,60 @@
+/* Copyright (C) 2023 Trevor Last
+ * See LICENSE file for copyright and license details.
+ */
+
+#ifndef FRONTENDNCURSES_LUADEFERRED_HPP
+#define FRONTENDNCURSES_LUADEFERRED_HPP
+
+#include "LuaCompat.hpp"
+
+#include <functional>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+
+/** A change to the Backend, to be applied on the main thread. */
+using BackendCommand = std::function<void()>;
+
+/**
+ * Lua states running off the main thread must not change the Backend
+ * directly. Once a state is deferred, the bindings queue their changes in
+ * COMMANDS instead, and hold MUTEX shared while reading the Backend.
+ */
+struct DeferredBackend
+{
+    std::shared_mutex *mutex;
+    std::vector<BackendCommand> commands{};
+};
+
+
+/** Defer L's Backend changes to D, which must outlive L. */
+void lua_setdeferred(lua_State *L, DeferredBackend *d);
+/** Get what L's Backend changes are deferred to, or nullptr. */
+DeferredBackend *lua_getdeferred(lua_State *L);
+
+/** Run FN now, or queue it if L is deferred. */
+template<typename Fn>
+void lua_defer(lua_State *L, Fn &&fn)
+{
+    if (auto const d = lua_getdeferred(L))
+        d->commands.emplace_back(std::forward<Fn>(fn));
+    else
+        fn();
+}
+
+/** Lock the Backend for reading. Does nothing unless L is deferred. */
+std::shared_lock<std::shared_mutex> lua_readlock(lua_State *L);
+/**
+ * Lock the Backend to change it right away, for changes with results. Does
+ * nothing unless L is deferred.
+ */
+std::unique_lock<std::shared_mutex> lua_writelock(lua_State *L);
+
+/** Write LINE to debugstream, from the main thread if L is deferred. */
+void lua_debuglog(lua_State *L, std::string line);
+
+
+#endif
@@ -5,8 +5,71 @@
 #include "LuaMessage.hpp"
 
 #include <util/debug.hpp>
+#include <util/strings.hpp>
 
-#include <cstring> // memset
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <new>
+#include <string_view>
+#include <vector>
+
+
+/** The state behind an IRC.Message. */
+struct MessageSlot
+{
+    /** nullptr while a pooled slot isn't lent. */
+    Message const *msg{nullptr};
+    /** Whether MSG is ours to free. */
+    bool owned{false};
+    /** Bumped whenever a pooled slot is released, invalidating handles. */
+    std::uint32_t generation{0};
+    /** Registry reference to the table Message:params() returned, if any. */
+    int params{LUA_NOREF};
+    /** Whether a method has read MSG since the slot was lent. */
+    bool read{false};
+#ifdef IRCC_LUAJIT
+    /** Filled in by Message:view(). */
+    MessageView view{};
+#endif
+};
+
+/**
+ * IRC.Message userdata: a handle to a slot, valid while the slot's
+ * generation matches. Owned messages have a slot of their own, freed by
+ * __gc; borrowed ones have a pooled slot, and no finalizer.
+ */
+struct MessageUserdata
+{
+    MessageSlot *slot;
+    std::uint32_t generation;
+};
+
+/**
+ * Slots for borrowed messages. They're never freed, as handles to them may
+ * outlive their loan.
+ */
+struct MessagePool
+{
+    std::deque<MessageSlot> slots{};
+    std::vector<MessageSlot *> free{};
+};
+
+/** Metatable of owned messages. */
+static char const *const OWNED_MT = "IRC.Message";
+/** Metatable of borrowed messages, which share the owned ones' methods. */
+static char const *const BORROWED_MT = "IRC.Message.borrowed";
+/** Registry field holding the MessagePool, as full userdata. */
+static char const *const POOL_KEY = "IRC.Message.pool";
+/** Longest IRC line, including the CRLF. */
+static constexpr size_t MAX_LINE = 512;
+/** Most parameters a message can have. */
+static constexpr size_t MAX_PARAMS = 15;
+/**
+ * Room left in PRIVMSGs and NOTICEs for the ":nick!user@host " the server
+ * puts in front when relaying them, which counts towards MAX_LINE.
+ */
+static constexpr size_t RELAY_PREFIX = 100;
 
 
 /**
@@ -16,8 +79,43 @@
  * Raises an error if the string is not a valid IRC message.
  */
 static int message_new(lua_State *L);
+/**
+ * Message.make(command: String, params: String...) -> IRC.Message...
+ *
+ * Construct a message from its command and parameters, without parsing.
+ * Only the last parameter may be empty, contain spaces or start with ':'.
+ * If the message is too long to send, the last parameter is split between
+ * several messages, which are all returned.
+ */
+static int message_make(lua_State *L);
+/**
+ * Message.privmsg(target: String, text: String) -> IRC.Message...
+ *
+ * Construct PRIVMSGs sending TEXT to TARGET: one per line of TEXT, split
+ * further if a line is too long to send. Empty lines are skipped.
+ */
+static int message_privmsg(lua_State *L);
+/**
+ * Message.notice(target: String, text: String) -> IRC.Message...
+ *
+ * Like Message.privmsg, for NOTICEs.
+ */
+static int message_notice(lua_State *L);
+/**
+ * Message.pong(token: String) -> IRC.Message
+ *
+ * Construct the reply to a PING with TOKEN.
+ */
+static int message_pong(lua_State *L);
 
+static int message_dunder_gc(lua_State *L);
 static int message_dunder_tostring(lua_State *L);
+/**
+ * Message:clone() -> IRC.Message
+ *
+ * Copy the Message, eg. to keep it after the handler returns.
+ */
+static int message__clone(lua_State *L);
 /**
  * Message:prefix() -> String|nil
  *
@@ -34,55 +132,197 @@ static int message__command(lua_State *L);
  * 1. Message:params() -> array[String]
  * 2. Message:params(idx: int) -> String
  *
- * 1. Get the Message's parameter list.
+ * 1. Get the Message's parameter list. The list is built on the first call
+ *    and the same table is returned after that, so it must not be modified.
  * 2. Get the Message's Nth parameter.
  */
 static int message__params(lua_State *L);
+#ifdef IRCC_LUAJIT
+/**
+ * Message:view() -> lightuserdata
+ *
+ * Get a pointer to a MessageView of the Message, for use with the FFI.
+ * scripts/compat.lua wraps this to return a typed cdata pointer instead.
+ */
+static int message__view(lua_State *L);
+#endif
 
 
 static const luaL_Reg backendlib_f[] = {
+    {"make", message_make},
     {"new", message_new},
+    {"notice", message_notice},
+    {"pong", message_pong},
+    {"privmsg", message_privmsg},
     {nullptr, nullptr}
 };
 
 static const luaL_Reg backendlib_m[] = {
+    {"__gc", message_dunder_gc},
     {"__tostring", message_dunder_tostring},
+    {"clone", message__clone},
     {"prefix", message__prefix},
     {"command", message__command},
     {"params", message__params},
+#ifdef IRCC_LUAJIT
+    {"view", message__view},
+#endif
     {nullptr, nullptr}
 };
 
 
+static int pool_dunder_gc(lua_State *L)
+{
+    static_cast<MessagePool *>(lua_touserdata(L, 1))->~MessagePool();
+    return 0;
+}
+
+
+static MessagePool &get_pool(lua_State *L)
+{
+    lua_getfield(L, LUA_REGISTRYINDEX, POOL_KEY);
+    auto const pool = static_cast<MessagePool *>(lua_touserdata(L, -1));
+    lua_pop(L, 1);
+    return *pool;
+}
+
+
+/** Get the IRC.Message at ARG, or raise an error if it isn't one. */
+static MessageUserdata *check_handle(lua_State *L, int arg)
+{
+    if (auto const ptr = luaL_testudata(L, arg, BORROWED_MT))
+        return static_cast<MessageUserdata *>(ptr);
+    return static_cast<MessageUserdata *>(luaL_checkudata(L, arg, OWNED_MT));
+}
+
+
+/** The slot of HANDLE, or nullptr if it's a released borrowed message. */
+static MessageSlot *live_slot(MessageUserdata const &handle)
+{
+    if (!handle.slot || handle.generation != handle.slot->generation)
+        return nullptr;
+    return handle.slot;
+}
+
+
+/** End the loan of pooled SLOT, invalidating its handle. */
+static void release_slot(lua_State *L, MessageSlot &slot)
+{
+    slot.msg = nullptr;
+    luaL_unref(L, LUA_REGISTRYINDEX, slot.params);
+    slot.params = LUA_NOREF;
+    ++slot.generation;
+    get_pool(L).free.push_back(&slot);
+}
+
+
+
 int luaopen_message(lua_State *L)
 {
-    luaL_newmetatable(L, "IRC.Message");
+    luaL_newmetatable(L, OWNED_MT);
     lua_pushvalue(L, -1);
     lua_setfield(L, -2, "__index");
-
     luaL_setfuncs(L, backendlib_m, 0);
-    lua_pop(L, 1);
+
+    // Borrowed messages share the methods, but don't need finalizing.
+    luaL_newmetatable(L, BORROWED_MT);
+    lua_pushvalue(L, -2);
+    lua_setfield(L, -2, "__index");
+    lua_pushcfunction(L, message_dunder_tostring);
+    lua_setfield(L, -2, "__tostring");
+    lua_pop(L, 2);
+
+    new (lua_newuserdatauv(L, sizeof(MessagePool), 0)) MessagePool{};
+    lua_createtable(L, 0, 1);
+    lua_pushcfunction(L, pool_dunder_gc);
+    lua_setfield(L, -2, "__gc");
+    lua_setmetatable(L, -2);
+    lua_setfield(L, LUA_REGISTRYINDEX, POOL_KEY);
 
     luaL_newlib(L, backendlib_f);
     return 1;
 }
 
 
-void lua_pushmessage(lua_State *L, Message const &msg)
+void lua_pushmessage(lua_State *L, Message msg)
+{
+    auto const ptr = static_cast<MessageUserdata *>(
+        lua_newuserdatauv(L, sizeof(MessageUserdata), 0));
+    ptr->slot = nullptr;
+    ptr->generation = 0;
+    luaL_setmetatable(L, OWNED_MT);
+    auto const slot = new MessageSlot{};
+    ptr->slot = slot;
+    slot->msg = new Message{std::move(msg)};
+    slot->owned = true;
+}
+
+
+void lua_pushborrowedmessage(lua_State *L, Message const &msg)
 {
-    Message *ptr = static_cast<Message *>(
-        lua_newuserdatauv(L, sizeof(Message), 0));
-    std::memset(ptr, 0, sizeof(Message));
-    *ptr = msg;
-    luaL_setmetatable(L, "IRC.Message");
+    auto &pool = get_pool(L);
+    auto const ptr = static_cast<MessageUserdata *>(
+        lua_newuserdatauv(L, sizeof(MessageUserdata), 0));
+    luaL_setmetatable(L, BORROWED_MT);
+    if (pool.free.empty())
+    {
+        pool.slots.emplace_back();
+        pool.free.push_back(&pool.slots.back());
+    }
+    auto const slot = pool.free.back();
+    pool.free.pop_back();
+    slot->msg = &msg;
+    slot->read = false;
+    ptr->slot = slot;
+    ptr->generation = slot->generation;
 }
 
 
-Message *luaL_checkmessage(lua_State *L, int arg)
+void lua_releasemessage(lua_State *L, int idx)
 {
-    auto msg = static_cast<Message *>(luaL_checkudata(L, arg, "IRC.Message"));
-    luaL_argcheck(L, msg != nullptr, arg, "`Message' expected");
-    return msg;
+    auto const slot = live_slot(*check_handle(L, idx));
+    if (slot && !slot->owned)
+        release_slot(L, *slot);
+}
+
+
+void lua_keepmessage(lua_State *L, int idx)
+{
+    idx = lua_absindex(L, idx);
+    auto const ptr = check_handle(L, idx);
+    auto const slot = live_slot(*ptr);
+    if (!slot || slot->owned)
+        return;
+
+    // Its params table goes with it.
+    auto const kept = new MessageSlot{};
+    kept->msg = new Message{*slot->msg};
+    kept->owned = true;
+    kept->params = slot->params;
+    slot->params = LUA_NOREF;
+    release_slot(L, *slot);
+    ptr->slot = kept;
+    ptr->generation = kept->generation;
+    lua_pushvalue(L, idx);
+    luaL_setmetatable(L, OWNED_MT);
+    lua_pop(L, 1);
+}
+
+
+bool lua_messageread(lua_State *L, int idx)
+{
+    auto const slot = live_slot(*check_handle(L, idx));
+    return slot && slot->read;
+}
+
+
+Message const *luaL_checkmessage(lua_State *L, int arg)
+{
+    auto const slot = live_slot(*check_handle(L, arg));
+    if (!slot)
+        luaL_argerror(L, arg, "message used after its handler returned");
+    slot->read = true;
+    return slot->msg;
 }
 
 
@@ -96,11 +336,174 @@ static int message_new(lua_State *L)
     } catch (std::runtime_error const &e) {
         luaL_error(L, "Failed to construct Message: %s", e.what());
     }
-    lua_pushmessage(L, msg);
+    lua_pushmessage(L, std::move(msg));
     return 1;
 }
 
 
+/**
+ * Raise an error unless MSG's parameters can be sent as they are. Returns
+ * the number of bytes MSG takes up without its last parameter.
+ */
+static size_t check_message(lua_State *L, Message const &msg)
+{
+    if (msg.params.size() > MAX_PARAMS)
+        luaL_error(L, "too many params (%d)", static_cast<int>(MAX_PARAMS));
+    // " :" before the last param, and the CRLF.
+    size_t size = msg.command.size() + 4;
+    for (size_t i = 0; i < msg.params.size(); ++i)
+    {
+        auto const &param = msg.params[i];
+        if (param.find_first_of(std::string_view{"\r\n\0", 3})
+            != std::string::npos)
+        {
+            luaL_error(
+                L, "param %d contains a line break or NUL",
+                static_cast<int>(i+1));
+        }
+        if (i+1 == msg.params.size())
+            break;
+        if (param.empty() || param[0] == ':'
+            || param.find(' ') != std::string::npos)
+        {
+            luaL_error(
+                L, "only the last param can be empty, or contain spaces or "
+                "a leading ':' (param %d)", static_cast<int>(i+1));
+        }
+        size += param.size() + 1;
+    }
+    if (size >= MAX_LINE)
+        luaL_error(L, "message too long");
+    return size;
+}
+
+
+/** Whether the server relays COMMAND to others, with a prefix. */
+static bool is_relayed(std::string const &command)
+{
+    auto const lower = lowercase(command);
+    return lower == "privmsg" || lower == "notice";
+}
+
+
+/**
+ * Push MSG, split into as many messages as it takes for each to fit in
+ * MAX_LINE, by cutting its last param between UTF-8 code points. Leaves
+ * RELAY_PREFIX spare if the server relays MSG. Returns the number of
+ * messages pushed.
+ */
+static int push_split(lua_State *L, Message msg)
+{
+    auto const fixed = check_message(L, msg)
+        + (is_relayed(msg.command)? RELAY_PREFIX : 0);
+    if (fixed >= MAX_LINE)
+        luaL_error(L, "message too long");
+    auto const room = MAX_LINE - fixed;
+    if (msg.params.empty() || msg.params.back().size() <= room)
+    {
+        lua_pushmessage(L, std::move(msg));
+        return 1;
+    }
+
+    auto const text = std::move(msg.params.back());
+    std::vector<Message> parts{};
+    for (size_t start = 0; start < text.size(); )
+    {
+        auto end = std::min(start + room, text.size());
+        while (end < text.size() && end > start && (text[end] & 0xc0) == 0x80)
+            --end;
+        if (end == start) // not UTF-8
+            end = std::min(start + room, text.size());
+        msg.params.back() = text.substr(start, end - start);
+        parts.push_back(msg);
+        start = end;
+    }
+    luaL_checkstack(L, parts.size(), "too many messages");
+    for (auto &part : parts)
+        lua_pushmessage(L, std::move(part));
+    return parts.size();
+}
+
+
+/** Push COMMAND messages sending the text at stack index 2 to index 1. */
+static int push_text(lua_State *L, char const *command)
+{
+    std::string const target{luaL_checkstring(L, 1)};
+    size_t len;
+    auto const text = luaL_checklstring(L, 2, &len);
+
+    int n = 0;
+    std::string_view rest{text, len};
+    while (!rest.empty())
+    {
+        auto const end = rest.find_first_of("\r\n");
+        auto const line = rest.substr(0, end);
+        if (!line.empty())
+            n += push_split(L, Message{command, {target, std::string{line}}});
+        if (end == std::string_view::npos)
+            break;
+        rest.remove_prefix(end + 1);
+    }
+    return n;
+}
+
+
+
+static int message_make(lua_State *L)
+{
+    Message msg{};
+    msg.command = luaL_checkstring(L, 1);
+    if (msg.command.empty()
+        || msg.command.find_first_not_of(
+            "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789")
+            != std::string::npos)
+    {
+        return luaL_argerror(L, 1, "not a command");
+    }
+    auto const top = lua_gettop(L);
+    for (int i = 2; i <= top; ++i)
+        msg.params.emplace_back(luaL_checkstring(L, i));
+    return push_split(L, std::move(msg));
+}
+
+
+static int message_privmsg(lua_State *L)
+{
+    return push_text(L, "PRIVMSG");
+}
+
+
+static int message_notice(lua_State *L)
+{
+    return push_text(L, "NOTICE");
+}
+
+
+static int message_pong(lua_State *L)
+{
+    Message msg{"PONG", {luaL_checkstring(L, 1)}};
+    check_message(L, msg);
+    lua_pushmessage(L, std::move(msg));
+    return 1;
+}
+
+
+static int message_dunder_gc(lua_State *L)
+{
+    // Only owned messages have a finalizer.
+    auto const ptr = static_cast<MessageUserdata *>(
+        luaL_checkudata(L, 1, OWNED_MT));
+    auto const slot = ptr->slot;
+    if (!slot)
+        return 0;
+    ptr->slot = nullptr;
+    luaL_unref(L, LUA_REGISTRYINDEX, slot->params);
+    delete slot->msg;
+    delete slot;
+    return 0;
+}
+
+
 static int message_dunder_tostring(lua_State *L)
 {
     auto const msg = luaL_checkmessage(L, 1);
@@ -110,6 +513,14 @@ static int message_dunder_tostring(lua_State *L)
 }
 
 
+static int message__clone(lua_State *L)
+{
+    auto const msg = luaL_checkmessage(L, 1);
+    lua_pushmessage(L, *msg);
+    return 1;
+}
+
+
 static int message__prefix(lua_State *L)
 {
     auto const msg = luaL_checkmessage(L, 1);
@@ -129,24 +540,66 @@ static int message__command(lua_State *L)
 }
 
 
+/** Push the string PARAM, which Lua interns if it is short. */
+static void push_param(lua_State *L, std::string const &param)
+{
+    lua_pushlstring(L, param.data(), param.size());
+}
+
+
 static int message__params(lua_State *L)
 {
     auto const msg = luaL_checkmessage(L, 1);
+    auto const slot = static_cast<MessageUserdata *>(lua_touserdata(L, 1))
+        ->slot;
+    auto const n = static_cast<lua_Integer>(msg->params.size());
     if (lua_gettop(L) == 2)
     {
         auto const i = luaL_checkinteger(L, 2);
-        if (i > msg->params.size())
-            return luaL_error(L, "out of range (%I/%d)", i, msg->params.size());
-        lua_pushstring(L, msg->params.at(i-1).c_str());
-    }
-    else
-    {
-        lua_newtable(L);
-        for (size_t i = 0; i < msg->params.size(); ++i)
+        if (i < 1 || i > n)
         {
-            lua_pushstring(L, msg->params.at(i).c_str());
-            lua_seti(L, -2, i+1);
+            return luaL_error(
+                L, "param %d out of range (%d)",
+                static_cast<int>(i), static_cast<int>(n));
         }
+        push_param(L, msg->params[i-1]);
+        return 1;
     }
+
+    if (slot->params != LUA_NOREF)
+    {
+        lua_rawgeti(L, LUA_REGISTRYINDEX, slot->params);
+        return 1;
+    }
+    lua_createtable(L, n, 0);
+    for (lua_Integer i = 0; i < n; ++i)
+    {
+        push_param(L, msg->params[i]);
+        lua_rawseti(L, -2, i+1);
+    }
+    lua_pushvalue(L, -1);
+    slot->params = luaL_ref(L, LUA_REGISTRYINDEX);
+    return 1;
+}
+
+
+#ifdef IRCC_LUAJIT
+static int message__view(lua_State *L)
+{
+    auto const msg = luaL_checkmessage(L, 1);
+    auto &view = static_cast<MessageUserdata *>(lua_touserdata(L, 1))
+        ->slot->view;
+
+    if (msg->prefix.has_value())
+        view.prefix = {msg->prefix->data(), msg->prefix->size()};
+    else
+        view.prefix = {nullptr, 0};
+    view.command = {msg->command.data(), msg->command.size()};
+    view.nparams = std::min(msg->params.size(), MessageView::MAX_PARAMS);
+    for (size_t i = 0; i < view.nparams; ++i)
+        view.params[i] = {msg->params[i].data(), msg->params[i].size()};
+
+    lua_pushlightuserdata(L, &view);
     return 1;
 }
+#endif
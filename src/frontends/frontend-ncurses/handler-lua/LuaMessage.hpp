@@ -7,15 +7,68 @@
 
 #include <irc/Message.hpp>
 
-#include <lua.hpp>
+#include "LuaCompat.hpp"
 
 
+/*
+ * An IRC.Message either owns its Message, which is freed when it is garbage
+ * collected, or borrows one for the duration of a handler call. A borrowed
+ * message is a small handle to a pooled slot, with no finalizer; releasing it
+ * returns the slot to the pool at once and bumps its generation, so using the
+ * handle afterwards raises an error. Scripts that keep a message past their
+ * handler must keep `msg:clone()` instead.
+ */
+
+#ifdef IRCC_LUAJIT
+/**
+ * C layout of a message for LuaJIT's FFI, returned by `msg:view()`. Must
+ * match the declaration in scripts/compat.lua. The strings point into the
+ * Message and aren't NUL-terminated, so the view is only valid while the
+ * IRC.Message is. Only the first MAX_PARAMS parameters are included.
+ */
+struct MessageView
+{
+    struct String
+    {
+        char const *data;
+        size_t size;
+    };
+    static constexpr size_t MAX_PARAMS = 15;
+
+    /** DATA is nullptr if there is no prefix. */
+    String prefix;
+    String command;
+    size_t nparams;
+    String params[MAX_PARAMS];
+};
+#endif
+
 /** Open the IRC.Message library. */
 int luaopen_message(lua_State *L);
-/** Push an IRC.Message onto the stack. */
-void lua_pushmessage(lua_State *L, Message const &msg);
-/** Checks whether stack item ARG is an IRC.Message and returns it. */
-Message *luaL_checkmessage(lua_State *L, int arg);
+/** Push an IRC.Message owning a copy of MSG onto the stack. */
+void lua_pushmessage(lua_State *L, Message msg);
+/** Push an IRC.Message borrowing MSG onto the stack. */
+void lua_pushborrowedmessage(lua_State *L, Message const &msg);
+/**
+ * End the borrow of the IRC.Message at stack index IDX, returning its slot to
+ * the pool.
+ */
+void lua_releasemessage(lua_State *L, int idx);
+/**
+ * Make the borrowed IRC.Message at stack index IDX own a copy of its
+ * message instead, eg. when its handler waits to be resumed.
+ */
+void lua_keepmessage(lua_State *L, int idx);
+/**
+ * Whether a method has read the borrowed IRC.Message at stack index IDX since
+ * it was pushed, eg. to tell how far a failed batch handler got.
+ */
+bool lua_messageread(lua_State *L, int idx);
+/**
+ * Checks whether stack item ARG is an IRC.Message and returns it. Raises an
+ * error if it is a released borrowed message.
+ */
+Message const *luaL_checkmessage(lua_State *L, int arg);
 
 
 #endif
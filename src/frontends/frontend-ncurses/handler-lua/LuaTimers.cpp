@@ -0,0 +1,172 @@
+/* Copyright (C) 2023 Trevor Last
+ * See LICENSE file for copyright and license details.
+ */
+
+#include "LuaTimers.hpp"
+
+#include <new>
+
+
+/** Registry field holding the TimerTable, as full userdata. */
+static char const *const TIMERS_KEY = "IRCC.timers";
+/** Cancelled timers the heap may hold before it's rebuilt. */
+static constexpr size_t MIN_COMPACT = 64;
+
+
+/**
+ * Timer:cancel() -> bool
+ *
+ * Stop the timer. Returns false if it already fired or was cancelled.
+ */
+static int timer__cancel(lua_State *L);
+
+
+static const luaL_Reg timerlib_m[] = {
+    {"cancel", timer__cancel},
+    {nullptr, nullptr}
+};
+
+
+static int timers_dunder_gc(lua_State *L)
+{
+    static_cast<TimerTable *>(lua_touserdata(L, 1))->~TimerTable();
+    return 0;
+}
+
+
+
+std::uint64_t TimerTable::add(
+    Clock::time_point when, std::chrono::milliseconds period, int ref,
+    std::string handler)
+{
+    if (size() >= MAX_TIMERS)
+        return 0;
+    auto const id = ++_last_id;
+    _timers.emplace(id, Timer{id, when, period, ref, std::move(handler)});
+    _heap.push({when, id});
+    _update_next();
+    return id;
+}
+
+
+int TimerTable::cancel(std::uint64_t id)
+{
+    auto const it = _timers.find(id);
+    if (it == _timers.end())
+        return LUA_NOREF;
+    auto const ref = it->second.ref;
+    _timers.erase(it);
+
+    if (_heap.size() > 2*_timers.size() + MIN_COMPACT)
+    {
+        std::vector<Due> live{};
+        live.reserve(_timers.size());
+        for (auto const &[timer_id, timer] : _timers)
+            live.push_back({timer.when, timer_id});
+        _heap = std::priority_queue<Due>{std::less<Due>{}, std::move(live)};
+    }
+    _update_next();
+    return ref;
+}
+
+
+std::vector<TimerTable::Timer> TimerTable::take(Clock::time_point now)
+{
+    std::vector<Timer> due{};
+    while (!_heap.empty() && _heap.top().when <= now)
+    {
+        auto const id = _heap.top().id;
+        _heap.pop();
+        auto const it = _timers.find(id);
+        if (it == _timers.end())
+            continue;
+
+        auto &timer = it->second;
+        due.push_back(timer);
+        if (timer.period.count() == 0)
+        {
+            _timers.erase(it);
+            continue;
+        }
+        // Periods missed while busy are skipped, not made up in a burst.
+        timer.when += timer.period;
+        if (timer.when <= now)
+            timer.when = now + timer.period;
+        _heap.push({timer.when, id});
+    }
+    _update_next();
+    return due;
+}
+
+
+TimerTable::Clock::time_point TimerTable::next() const
+{
+    return Clock::time_point{
+        Clock::duration{_next.load(std::memory_order_relaxed)}};
+}
+
+
+void TimerTable::_update_next()
+{
+    while (!_heap.empty() && _timers.count(_heap.top().id) == 0)
+        _heap.pop();
+    _next.store(
+        _heap.empty()? NEVER : _heap.top().when.time_since_epoch().count(),
+        std::memory_order_relaxed);
+}
+
+
+
+TimerTable *lua_newtimers(lua_State *L)
+{
+    auto const timers = new (lua_newuserdatauv(L, sizeof(TimerTable), 0))
+        TimerTable{};
+    lua_createtable(L, 0, 1);
+    lua_pushcfunction(L, timers_dunder_gc);
+    lua_setfield(L, -2, "__gc");
+    lua_setmetatable(L, -2);
+    lua_setfield(L, LUA_REGISTRYINDEX, TIMERS_KEY);
+    return timers;
+}
+
+
+TimerTable *lua_gettimers(lua_State *L)
+{
+    lua_getfield(L, LUA_REGISTRYINDEX, TIMERS_KEY);
+    auto const timers = static_cast<TimerTable *>(lua_touserdata(L, -1));
+    lua_pop(L, 1);
+    return timers;
+}
+
+
+int luaopen_timer(lua_State *L)
+{
+    luaL_newmetatable(L, "IRCC.Timer");
+    lua_pushvalue(L, -1);
+    lua_setfield(L, -2, "__index");
+    luaL_setfuncs(L, timerlib_m, 0);
+    lua_pop(L, 1);
+    return 0;
+}
+
+
+void lua_pushtimer(lua_State *L, std::uint64_t id)
+{
+    auto const ptr = static_cast<std::uint64_t *>(
+        lua_newuserdatauv(L, sizeof(id), 0));
+    *ptr = id;
+    luaL_setmetatable(L, "IRCC.Timer");
+}
+
+
+
+static int timer__cancel(lua_State *L)
+{
+    auto const id = *static_cast<std::uint64_t *>(
+        luaL_checkudata(L, 1, "IRCC.Timer"));
+    auto const timers = lua_gettimers(L);
+    auto const ref = timers? timers->cancel(id) : LUA_NOREF;
+    luaL_unref(L, LUA_REGISTRYINDEX, ref);
+    lua_pushboolean(L, ref != LUA_NOREF);
+    return 1;
+}
@@ -0,0 +1,113 @@
+/* Copyright (C) 2023 Trevor Last
+ * See LICENSE file for copyright and license details.
+ */
+
+#ifndef FRONTENDNCURSES_LUATIMERS_HPP
+#define FRONTENDNCURSES_LUATIMERS_HPP
+
+#include "LuaCompat.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <queue>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+
+/**
+ * A Lua state's timers, from `Backend:after`, `Backend:every` and
+ * `Backend:sleep`. Each holds a registry reference to the function to call,
+ * or the coroutine to resume.
+ *
+ * Timers are kept in a heap, so adding one and taking the due ones cost
+ * O(log n) each. A cancelled timer stays in the heap until it comes up,
+ * unless most of the heap is cancelled timers, when it is rebuilt.
+ * `next` may be called from any thread; the rest must be called on the
+ * state's thread.
+ */
+class TimerTable
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    /** Most timers that may be pending at once. */
+    static constexpr size_t MAX_TIMERS = 1 << 16;
+
+    struct Timer
+    {
+        std::uint64_t id;
+        Clock::time_point when;
+        /** How often it repeats, or 0 if it only fires once. */
+        std::chrono::milliseconds period;
+        /** Registry reference to the function or coroutine. */
+        int ref;
+        /** Handler a sleeping coroutine runs, eg. "privmsg". */
+        std::string handler;
+    };
+
+private:
+    static constexpr Clock::rep NEVER =
+        Clock::time_point::max().time_since_epoch().count();
+
+    struct Due
+    {
+        Clock::time_point when;
+        std::uint64_t id;
+
+        /** For a min-heap: earliest first, then in the order added. */
+        bool operator<(Due const &other) const
+        {
+            return (when != other.when)? when > other.when : id > other.id;
+        }
+    };
+
+    std::priority_queue<Due> _heap{};
+    std::unordered_map<std::uint64_t, Timer> _timers{};
+    std::uint64_t _last_id{0};
+    /** When the first live timer is due, as Clock ticks. */
+    std::atomic<Clock::rep> _next{NEVER};
+
+    /** Drop cancelled timers from the heap's top, and update _next. */
+    void _update_next();
+
+public:
+    /**
+     * Add a timer due at WHEN, repeating every PERIOD if non-zero. Returns
+     * its ID, or 0 if the table is full.
+     */
+    std::uint64_t add(
+        Clock::time_point when, std::chrono::milliseconds period, int ref,
+        std::string handler={});
+    /**
+     * Cancel timer ID. Returns its registry reference to release, or
+     * LUA_NOREF if it already fired or was cancelled.
+     */
+    int cancel(std::uint64_t id);
+    /**
+     * Take the timers due at NOW, earliest first. Repeating timers are
+     * rescheduled, and keep their references; the rest are removed.
+     */
+    std::vector<Timer> take(Clock::time_point now);
+
+    /** When the next timer is due, or Clock::time_point::max(). */
+    Clock::time_point next() const;
+    /** Whether timer ID is still to fire. */
+    bool pending(std::uint64_t id) const {return _timers.count(id) != 0;}
+    size_t size() const {return _timers.size();}
+};
+
+
+/** Give L a timer table, which lives as long as L. */
+TimerTable *lua_newtimers(lua_State *L);
+/** Get L's timer table, or nullptr. */
+TimerTable *lua_gettimers(lua_State *L);
+
+/** Open the IRCC.Timer library: handles to cancel timers with. */
+int luaopen_timer(lua_State *L);
+/** Push an IRCC.Timer for timer ID. */
+void lua_pushtimer(lua_State *L, std::uint64_t id);
+
+
+#endif
@@ -34,6 +34,13 @@ void Frontend::process_message(Message const &msg)
 }
 
 
+void Frontend::process_messages(std::vector<Message> const &messages)
+{
+    for (auto const &msg : messages)
+        process_message(msg);
+}
+
+
 
 void Frontend::output(Message const &message)
 {
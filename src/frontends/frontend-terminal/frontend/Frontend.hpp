@@ -8,6 +8,9 @@
 #include <irc/Message.hpp>
 #include <util/Signal.hpp>
 
+#include <chrono>
+#include <vector>
+
 
 /**
  * FrontendTerminal.
@@ -25,6 +28,21 @@ public:
 
     /** Process available IRC messages from CLIENT. */
     void process_message(Message const &message);
+    /** Process a burst of IRC messages recieved together, in order. */
+    void process_messages(std::vector<Message> const &messages);
+
+    /** File descriptors to watch for reading. There are none. */
+    std::vector<int> get_watch_fds() const {return {};}
+    bool watch_fd_ready(int) {return false;}
+    /** No background work. */
+    bool idle() {return false;}
+
+    /** Never emitted; there are no timers. */
+    Signal<void(std::chrono::steady_clock::time_point)> signal_timers_due{};
+    void timers() {}
+
+    /** Nothing waits for replies. */
+    void disconnected() {}
 
 private:
     void output(Message const &message);
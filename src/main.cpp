@@ -13,6 +13,7 @@
 #include <unistd.h>     // STDIN_FILENO
 
 #include <iostream>
+#include <vector>
 
 
 /** Called by MainLoop when STDIN has some input for us. */
@@ -26,14 +27,25 @@ bool stdin_cb(FDStateFlags events, Frontend &frontend)
 }
 
 
+/** Called by MainLoop when one of the frontend's own fds is ready. */
+bool frontend_cb(FDStateFlags events, int fd, Frontend &frontend)
+{
+    if (events & FDState::ERROR)
+        return true;
+    if (events & FDState::READ)
+        return frontend.watch_fd_ready(fd);
+    return false;
+}
+
+
 /** Called by IRCClient when it has messages ready to be recieved. */
 void frontend_recieve_messages(Frontend &frontend, IRCClient &client)
 {
+    // Hand the whole burst over at once.
+    std::vector<Message> messages{};
     while (!client.is_recieve_queue_empty())
-    {
-        auto const msg = client.pop();
-        frontend.process_message(msg);
-    }
+        messages.push_back(client.pop());
+    frontend.process_messages(messages);
 }
 
 
@@ -146,7 +158,41 @@ int main(int argc, char *argv[])
             irc_socket,
             std::ref(irc_client)));
     mainloop.signal_on_closed(irc_socket).connect(
-        [&mainloop](){mainloop.remove_fd(STDIN_FILENO);});
+        [&mainloop, &frontend](){
+            frontend.disconnected();
+            mainloop.remove_fd(STDIN_FILENO);
+            for (auto const fd : frontend.get_watch_fds())
+                mainloop.remove_fd(fd);
+        });
+
+    // Frontend monitors.
+    for (auto const fd : frontend.get_watch_fds())
+    {
+        mainloop.add_fd(fd);
+        mainloop.set_get_monitor_fn(fd, [](){return FDState::READ;});
+        mainloop.signal_on_polled(fd).connect(
+            [&frontend, fd](auto events){
+                return frontend_cb(events, fd, frontend);});
+    }
+
+    // Background work, eg. garbage collection, between bursts of activity.
+    mainloop.signal_idle.connect([&frontend](){return frontend.idle();});
+
+    // The frontend's timers, through one MainLoop timer for the earliest.
+    MainLoop::TimerId frontend_timer = 0;
+    frontend.signal_timers_due.connect(
+        [&mainloop, &frontend, &frontend_timer](auto when){
+            mainloop.cancel_timer(frontend_timer);
+            frontend_timer = 0;
+            if (when == MainLoop::Clock::time_point::max())
+                return;
+            frontend_timer = mainloop.add_timer(
+                when,
+                [&frontend, &frontend_timer](){
+                    frontend_timer = 0;
+                    frontend.timers();
+                });
+        });
 
     mainloop.run();
 
@@ -0,0 +1,97 @@
+/* Copyright (C) 2023 Trevor Last
+ * See LICENSE file for copyright and license details.
+ */
+
+#include "util/MappedFile.hpp"
+
+#include <fcntl.h>      // open
+#include <sys/file.h>   // flock
+#include <sys/mman.h>   // mmap, mremap, munmap
+#include <sys/stat.h>   // fstat
+#include <unistd.h>     // close, ftruncate
+
+#include <cerrno>
+
+#include <system_error>
+
+
+MappedFile::MappedFile(std::string const &path)
+{
+    errno = 0;
+    _fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (_fd == -1)
+        throw std::system_error{errno, std::generic_category(), "open()"};
+
+    struct stat st;
+    if (fstat(_fd, &st) == -1)
+    {
+        auto const err = errno;
+        close(_fd);
+        throw std::system_error{err, std::generic_category(), "fstat()"};
+    }
+
+    try {
+        resize(st.st_size);
+    }
+    catch (...) {
+        close(_fd);
+        throw;
+    }
+}
+
+
+MappedFile::~MappedFile()
+{
+    if (_data)
+        munmap(_data, _capacity);
+    close(_fd);
+}
+
+
+void MappedFile::reserve(size_t size)
+{
+    if (size <= _capacity)
+        return;
+
+    // Grow geometrically so appends don't remap every time.
+    size_t capacity = _capacity? _capacity : 64 * 1024;
+    while (capacity < size)
+        capacity *= 2;
+    resize(capacity);
+}
+
+
+void MappedFile::resize(size_t size)
+{
+    errno = 0;
+    if (ftruncate(_fd, size) == -1)
+        throw std::system_error{errno, std::generic_category(), "ftruncate()"};
+
+    void *data;
+    if (size == 0)
+    {
+        if (_data)
+            munmap(_data, _capacity);
+        data = nullptr;
+    }
+    else if (_data)
+        data = mremap(_data, _capacity, size, MREMAP_MAYMOVE);
+    else
+        data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+
+    if (data == MAP_FAILED)
+        throw std::system_error{errno, std::generic_category(), "mmap()"};
+    _data = static_cast<char *>(data);
+    _capacity = size;
+}
+
+
+bool MappedFile::try_lock()
+{
+    errno = 0;
+    if (flock(_fd, LOCK_EX | LOCK_NB) == 0)
+        return true;
+    if (errno == EWOULDBLOCK)
+        return false;
+    throw std::system_error{errno, std::generic_category(), "flock()"};
+}
@@ -4,6 +4,32 @@
 
 #include "util/strings.hpp"
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+
+/** Position of the first space in STR at or after FROM, or STR's size. */
+static size_t find_space(std::string_view str, size_t from)
+{
+    size_t i = from;
+#if defined(__SSE2__)
+    auto const space = _mm_set1_epi8(' ');
+    for (; i + 16 <= str.size(); i += 16)
+    {
+        auto const v = _mm_loadu_si128(
+            reinterpret_cast<__m128i const *>(str.data() + i));
+        auto const mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, space));
+        if (mask != 0)
+            return i + __builtin_ctz(mask);
+    }
+#endif
+    while (i < str.size() && str[i] != ' ')
+        i++;
+    return i;
+}
+
+
 
 std::string lowercase(std::string const &str)
 {
@@ -12,3 +38,48 @@ std::string lowercase(std::string const &str)
         out.push_back(std::tolower(ch));
     return out;
 }
+
+
+CaseMapping parse_casemapping(std::string_view name)
+{
+    if (name == "ascii")
+        return CaseMapping::ASCII;
+    else if (name == "strict-rfc1459")
+        return CaseMapping::STRICT_RFC1459;
+    else
+        return CaseMapping::RFC1459;
+}
+
+
+std::string casefold(std::string_view str, CaseMapping mapping)
+{
+    std::string out{str};
+    for (auto &ch : out)
+    {
+        if (ch >= 'A' && ch <= 'Z')
+            ch += 'a' - 'A';
+        else if (mapping == CaseMapping::ASCII)
+            continue;
+        // RFC 1459 treats []\ as the uppercase forms of {}|, and non-strict
+        // RFC 1459 also has ~ as the uppercase ^.
+        else if (ch == '[' || ch == ']' || ch == '\\')
+            ch += '{' - '[';
+        else if (ch == '~' && mapping == CaseMapping::RFC1459)
+            ch = '^';
+    }
+    return out;
+}
+
+
+std::vector<std::string_view> split_words(std::string_view str)
+{
+    std::vector<std::string_view> words{};
+    for (size_t i = 0; i < str.size(); )
+    {
+        auto const end = find_space(str, i);
+        if (end != i)
+            words.push_back(str.substr(i, end - i));
+        i = end + 1;
+    }
+    return words;
+}
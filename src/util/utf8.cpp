@@ -0,0 +1,214 @@
+/* Copyright (C) 2023 Trevor Last
+ * See LICENSE file for copyright and license details.
+ */
+
+#include "util/utf8.hpp"
+
+#include <cwchar>       // wcwidth
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+
+static constexpr char32_t REPLACEMENT = 0xfffd;
+
+
+/** Length of the run of printable ASCII at the start of STR. */
+static size_t ascii_prefix(std::string_view str)
+{
+    size_t i = 0;
+#if defined(__SSE2__)
+    // Bytes are compared as signed, so anything >= 0x80 is also "< 0x20".
+    auto const space = _mm_set1_epi8(0x20);
+    auto const del = _mm_set1_epi8(0x7f);
+    for (; i + 16 <= str.size(); i += 16)
+    {
+        auto const v = _mm_loadu_si128(
+            reinterpret_cast<__m128i const *>(str.data() + i));
+        auto const bad = _mm_or_si128(
+            _mm_cmplt_epi8(v, space),
+            _mm_cmpeq_epi8(v, del));
+        auto const mask = _mm_movemask_epi8(bad);
+        if (mask != 0)
+            return i + __builtin_ctz(mask);
+    }
+#endif
+    for (; i < str.size(); ++i)
+    {
+        unsigned char const ch = str[i];
+        if (ch < 0x20 || ch >= 0x7f)
+            break;
+    }
+    return i;
+}
+
+
+/** true for C0 and C1 control characters, and DEL. */
+static bool is_control(char32_t cp)
+{
+    return cp < 0x20 || (cp >= 0x7f && cp < 0xa0);
+}
+
+
+/**
+ * Decode the sequence at byte I of STR. Returns the number of bytes in the
+ * sequence, or 0 if it is invalid.
+ */
+static size_t decode(std::string_view str, size_t i, char32_t &cp)
+{
+    unsigned char const lead = str[i];
+    size_t length;
+    char32_t min;
+    if (lead < 0x80)
+    {
+        cp = lead;
+        return 1;
+    }
+    else if ((lead & 0xe0) == 0xc0)
+    {
+        length = 2;
+        min = 0x80;
+        cp = lead & 0x1f;
+    }
+    else if ((lead & 0xf0) == 0xe0)
+    {
+        length = 3;
+        min = 0x800;
+        cp = lead & 0x0f;
+    }
+    else if ((lead & 0xf8) == 0xf0)
+    {
+        length = 4;
+        min = 0x10000;
+        cp = lead & 0x07;
+    }
+    else
+        return 0;
+
+    if (i + length > str.size())
+        return 0;
+    for (size_t j = 1; j < length; ++j)
+    {
+        unsigned char const ch = str[i + j];
+        if ((ch & 0xc0) != 0x80)
+            return 0;
+        cp = (cp << 6) | (ch & 0x3f);
+    }
+
+    // Reject overlong encodings, surrogates and out-of-range code points.
+    if (cp < min || cp > 0x10ffff || (cp >= 0xd800 && cp <= 0xdfff))
+        return 0;
+    return length;
+}
+
+
+
+bool utf8_is_printable(std::string_view str)
+{
+    for (size_t i = ascii_prefix(str); i < str.size(); )
+    {
+        char32_t cp;
+        auto const length = decode(str, i, cp);
+        if (length == 0 || is_control(cp))
+            return false;
+        i += length;
+        i += ascii_prefix(str.substr(i));
+    }
+    return true;
+}
+
+
+std::string utf8_sanitize(std::string_view str)
+{
+    std::string out{};
+    out.reserve(str.size());
+    for (size_t i = 0; i < str.size(); )
+    {
+        auto const run = ascii_prefix(str.substr(i));
+        out.append(str, i, run);
+        i += run;
+        if (i == str.size())
+            break;
+
+        char32_t cp;
+        auto const length = decode(str, i, cp);
+        if (length == 0)
+        {
+            utf8_append(out, REPLACEMENT);
+            i += 1;
+        }
+        else
+        {
+            if (!is_control(cp))
+                out.append(str, i, length);
+            i += length;
+        }
+    }
+    return out;
+}
+
+
+char32_t utf8_decode(std::string_view str, size_t &i)
+{
+    char32_t cp;
+    auto const length = decode(str, i, cp);
+    if (length == 0)
+    {
+        i += 1;
+        return REPLACEMENT;
+    }
+    i += length;
+    return cp;
+}
+
+
+void utf8_append(std::string &out, char32_t cp)
+{
+    if (cp < 0x80)
+        out.push_back(cp);
+    else if (cp < 0x800)
+    {
+        out.push_back(0xc0 | (cp >> 6));
+        out.push_back(0x80 | (cp & 0x3f));
+    }
+    else if (cp < 0x10000)
+    {
+        out.push_back(0xe0 | (cp >> 12));
+        out.push_back(0x80 | ((cp >> 6) & 0x3f));
+        out.push_back(0x80 | (cp & 0x3f));
+    }
+    else
+    {
+        out.push_back(0xf0 | (cp >> 18));
+        out.push_back(0x80 | ((cp >> 12) & 0x3f));
+        out.push_back(0x80 | ((cp >> 6) & 0x3f));
+        out.push_back(0x80 | (cp & 0x3f));
+    }
+}
+
+
+int codepoint_width(char32_t cp)
+{
+    if (cp >= 0x20 && cp < 0x7f)
+        return 1;
+    auto const width = wcwidth(static_cast<wchar_t>(cp));
+    // Unassigned code points are reported as non-printable; assume they take
+    // up a single column.
+    return width < 0? 1 : width;
+}
+
+
+size_t utf8_width(std::string_view str)
+{
+    size_t width = 0;
+    for (size_t i = 0; i < str.size(); )
+    {
+        auto const run = ascii_prefix(str.substr(i));
+        width += run;
+        i += run;
+        if (i < str.size())
+            width += codepoint_width(utf8_decode(str, i));
+    }
+    return width;
+}
@@ -0,0 +1,48 @@
+/* Copyright (C) 2023 Trevor Last
+ * See LICENSE file for copyright and license details.
+ */
+
+#ifndef UTIL_MAPPEDFILE_HPP
+#define UTIL_MAPPEDFILE_HPP
+
+#include <string>
+
+
+/**
+ * A file mapped read/write into memory.
+ *
+ * The mapping covers the whole file, and can be grown with 'reserve'. Growing
+ * the mapping may move it, so pointers into the file are invalidated.
+ */
+class MappedFile
+{
+    int _fd{-1};
+    char *_data{nullptr};
+    size_t _capacity{0};
+
+public:
+    /** Open (creating if needed) the file at PATH and map it. */
+    MappedFile(std::string const &path);
+    MappedFile(MappedFile const &)=delete;
+    MappedFile &operator=(MappedFile const &)=delete;
+    ~MappedFile();
+
+    char *data() {return _data;}
+    char const *data() const {return _data;}
+    /** Size of the file/mapping. */
+    size_t capacity() const {return _capacity;}
+
+    /** Grow the file and mapping to at least SIZE bytes. */
+    void reserve(size_t size);
+    /** Resize the file to exactly SIZE bytes. */
+    void resize(size_t size);
+
+    /**
+     * Take an exclusive advisory lock on the file, without waiting. Returns
+     * false if another open file holds it. Released when this is destroyed.
+     */
+    bool try_lock();
+};
+
+
+#endif
@@ -7,10 +7,30 @@
 
 
 #include <string>
+#include <string_view>
+#include <vector>
+
+
+/** IRC casemappings, as advertised by the CASEMAPPING ISUPPORT token. */
+enum class CaseMapping
+{
+    ASCII,
+    RFC1459,
+    STRICT_RFC1459,
+};
 
 
 /** Convert a string to lowercase. */
 std::string lowercase(std::string const &str);
 
+/** Get the casemapping named NAME. Unknown names give RFC1459. */
+CaseMapping parse_casemapping(std::string_view name);
+
+/** Fold a nick or channel name to lowercase under MAPPING. */
+std::string casefold(std::string_view str, CaseMapping mapping);
+
+/** Split STR at spaces. Empty words are skipped. */
+std::vector<std::string_view> split_words(std::string_view str);
+
 
 #endif
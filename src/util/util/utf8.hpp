@@ -0,0 +1,40 @@
+/* Copyright (C) 2023 Trevor Last
+ * See LICENSE file for copyright and license details.
+ */
+
+#ifndef UTIL_UTF8_HPP
+#define UTIL_UTF8_HPP
+
+#include <string>
+#include <string_view>
+
+
+/**
+ * true if STR is valid UTF-8 without any control characters, ie. it can be
+ * drawn as-is.
+ */
+bool utf8_is_printable(std::string_view str);
+
+/**
+ * Make STR printable. Invalid UTF-8 sequences are replaced with U+FFFD, and
+ * control characters are removed.
+ */
+std::string utf8_sanitize(std::string_view str);
+
+/**
+ * Decode the code point starting at byte I of STR, and advance I past it.
+ * Invalid sequences decode to U+FFFD, consuming one byte.
+ */
+char32_t utf8_decode(std::string_view str, size_t &i);
+
+/** Append the UTF-8 encoding of CP to OUT. */
+void utf8_append(std::string &out, char32_t cp);
+
+/** Number of terminal columns taken up by CP. */
+int codepoint_width(char32_t cp);
+
+/** Number of terminal columns taken up by STR, which must be printable. */
+size_t utf8_width(std::string_view str);
+
+
+#endif